@@ -0,0 +1,552 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Microbenchmark of the externals' perform routines. Each case creates an object through the Pd
+//  stub (or a chain of them, oscillator -> *~ -> foldback~, to set against blepfold~), builds its
+//  DSP chain for a block size, and times the chain over synthetic input. Results
+//  are written as JSON, one result per line, so that runs from different commits can be diffed or
+//  compared with --baseline.
+//
+
+#include "pd_stub.h"
+#include "cpu_features.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#if defined(CPU_X86) && !defined(_MSC_VER)
+# include <x86intrin.h>
+#endif
+
+#define BENCH_SAMPLE_RATE 48000.f
+#define BENCH_INPUTS_MAX 8
+#define BENCH_BLOCKS_MAX 16
+#define BENCH_TRIALS_MAX 64
+#define BENCH_SCHEMA 1
+#define BENCH_TWOPI 6.283185307179586
+
+/* BENCH_LIBRARY builds against the single-binary library, whose setup registers every object. */
+#ifdef BENCH_LIBRARY
+void pd_externals_setup (void);
+#else
+void polyblep_tilde_setup (void);
+void foldback_tilde_setup (void);
+void blepfold_tilde_setup (void);
+#endif
+
+typedef enum {
+    BENCH_INPUT_CONSTANT = 0,
+    BENCH_INPUT_SINE /* offset + amplitude * sin(2 pi frequency t) */
+} bench_input_kind_t;
+
+typedef struct _bench_input {
+    bench_input_kind_t kind;
+    double offset;
+    double amplitude;
+    double frequency;
+} bench_input_t;
+
+typedef struct _bench_case {
+    const char *name;
+    const char *className;
+    const char *args; /* Creation arguments, which also pick the quality settings. */
+    int numOutputs;
+    int numInputs;
+    bench_input_t inputs[BENCH_INPUTS_MAX];
+    /* For a chain, the creation arguments of a foldback~ that the (single) output goes through after a *~
+     by 'drive', with 'threshold' on its threshold inlet. NULL for a single object. */
+    const char *foldArgs;
+    bench_input_t drive;
+    bench_input_t threshold;
+} bench_case_t;
+
+#define BENCH_CONSTANT(value) { BENCH_INPUT_CONSTANT, (value), 0., 0. }
+#define BENCH_SINE(offset, amplitude, frequency) { BENCH_INPUT_SINE, (offset), (amplitude), (frequency) }
+
+/* polyblep~ inputs are frequency, sync and width; foldback~ inputs are the channels, then the threshold. */
+#define POLYBLEP_INPUTS(frequency) 3, { frequency, BENCH_CONSTANT(0.), BENCH_CONSTANT(0.5) }
+#define FOLDBACK_INPUT BENCH_SINE(0., 1.5, 110.)
+
+static const bench_case_t bench_cases[] = {
+    { "polyblep_saw", "polyblep~", "440", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_fm", "polyblep~", "440", 1, POLYBLEP_INPUTS(BENCH_SINE(440., 220., 5.)) },
+    { "polyblep_saw_intphase", "polyblep~", "440 -intphase", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_quality1", "polyblep~", "440 -quality 1", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_quality2", "polyblep~", "440 -quality 2", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_wavetable", "polyblep~", "440 -wavetable", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_square", "polyblep~", "440 -shape square", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_pulse", "polyblep~", "440 -shape pulse", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_triangle", "polyblep~", "440 -shape triangle", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_voices7", "polyblep~", "440 -voices 7", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_os2", "polyblep~", "440 -os 2", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_os4", "polyblep~", "440 -os 4", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_os8", "polyblep~", "440 -os 8", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "polyblep_saw_os4_adaptive", "polyblep~", "440 -quality 2 -os 4 -adaptive", 1,
+      POLYBLEP_INPUTS(BENCH_CONSTANT(440.)) },
+    { "foldback", "foldback~", "0.5", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_threshold_mod", "foldback~", "0.5", 1, 2, { FOLDBACK_INPUT, BENCH_SINE(0.5, 0.2, 3.) } },
+    { "foldback_in_range", "foldback~", "0.5", 1, 2, { BENCH_SINE(0., 0.4, 110.), BENCH_CONSTANT(0.5) } },
+    { "foldback_adaa1", "foldback~", "0.5 -adaa 1", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_adaa2", "foldback~", "0.5 -adaa 2", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_stages4", "foldback~", "0.5 -stages 4", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_os2", "foldback~", "0.5 -os 2", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_os4", "foldback~", "0.5 -os 4", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_os8", "foldback~", "0.5 -os 8", 1, 2, { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_os4_adaptive", "foldback~", "0.5 -adaa 2 -os 4 -adaptive", 1, 2,
+      { FOLDBACK_INPUT, BENCH_CONSTANT(0.5) } },
+    { "foldback_channels4", "foldback~", "0.5 -channels 4", 4, 5,
+      { FOLDBACK_INPUT, BENCH_SINE(0., 1.5, 220.), BENCH_SINE(0., 1.5, 330.), BENCH_SINE(0., 1.5, 440.),
+        BENCH_CONSTANT(0.5) } },
+    { "blepfold", "blepfold~", "440 2 0.4", 1, 1, { BENCH_CONSTANT(440.) } },
+    { "blepfold_fm", "blepfold~", "440 2 0.4", 1, 1, { BENCH_SINE(440., 220., 5.) } },
+    /* What blepfold~ replaces: the same saw, drive and threshold as three objects. */
+    { "chain_intphase", "polyblep~", "440 -intphase", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)),
+      "0.4", BENCH_CONSTANT(2.), BENCH_CONSTANT(0.4) },
+    { "chain_intphase_fm", "polyblep~", "440 -intphase", 1, POLYBLEP_INPUTS(BENCH_SINE(440., 220., 5.)),
+      "0.4", BENCH_CONSTANT(2.), BENCH_CONSTANT(0.4) },
+    { "chain", "polyblep~", "440", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)),
+      "0.4", BENCH_CONSTANT(2.), BENCH_CONSTANT(0.4) },
+    { "chain_signal_controls", "polyblep~", "440", 1, POLYBLEP_INPUTS(BENCH_CONSTANT(440.)),
+      "0.4", BENCH_SINE(2., 1., 3.), BENCH_SINE(0.4, 0.1, 2.) },
+};
+
+#define BENCH_NUM_CASES ((int)(sizeof(bench_cases) / sizeof(bench_cases[0])))
+
+static const int bench_default_blocks[] = { 1, 8, 64, 256, 1024, 4096 };
+static const int bench_quick_blocks[] = { 1, 64, 4096 };
+
+typedef struct _bench_result {
+    double nsPerSample; /* Median over the trials. */
+    double nsPerSampleMin;
+    double cyclesPerSample; /* Time stamp counter ticks, or < 0 where there is none. */
+    int finite; /* Whether every output sample was finite. */
+} bench_result_t;
+
+/* ---------------------------------------------------------------------------------------- */
+
+static double
+bench_now_ns (void) {
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+static double
+bench_cycles (void) {
+#if defined(CPU_X86)
+    return (double)__rdtsc();
+#else
+    return -1.;
+#endif
+}
+
+static void
+bench_input_fill (const bench_input_t* input, t_sample* vec, int numSamples) {
+    int i;
+    for (i = 0; i < numSamples; i++) {
+        if (input->kind == BENCH_INPUT_SINE) {
+            vec[i] = (t_sample)(input->offset + input->amplitude * sin(BENCH_TWOPI * input->frequency * i / BENCH_SAMPLE_RATE));
+        } else {
+            vec[i] = (t_sample)input->offset;
+        }
+    }
+}
+
+/* The *~ of a chain, as Pd computes it: by the float given as its argument, or by a signal on its right inlet. */
+static t_int*
+bench_scalar_times_perform (t_int* args) {
+    const t_sample *in = (const t_sample *)args[1];
+    t_float gain = *(const t_float *)args[2];
+    t_sample *out = (t_sample *)args[3];
+    int n = (int)args[4];
+    while (n--) {
+        *out++ = *in++ * gain;
+    }
+    return (args + 5);
+}
+
+static t_int*
+bench_times_perform (t_int* args) {
+    const t_sample *in1 = (const t_sample *)args[1];
+    const t_sample *in2 = (const t_sample *)args[2];
+    t_sample *out = (t_sample *)args[3];
+    int n = (int)args[4];
+    while (n--) {
+        *out++ = *in1++ * *in2++;
+    }
+    return (args + 5);
+}
+
+static int
+bench_compare_doubles (const void* a, const void* b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* Times one case at one block size. Returns 0 if the object could not be created. */
+static int
+bench_run (const bench_case_t* bc, int blockSize, double trialNs, int numTrials, bench_result_t* result) {
+    stub_signals_t signals, fold; /* For a chain, the signals of its foldback~: input, threshold, output. */
+    t_signal *output;
+    t_pd *obj, *folder = NULL;
+    t_sample *drive = NULL;
+    t_float gain = (t_float)bc->drive.offset;
+    double ns[BENCH_TRIALS_MAX], cycles[BENCH_TRIALS_MAX], sorted[BENCH_TRIALS_MAX];
+    double start, elapsed;
+    long ticks, warmup, t;
+    int i, trial;
+
+    obj = stub_new(bc->className, bc->args);
+    if (!obj) {
+        return 0;
+    }
+
+    stub_signals_init(&signals, bc->numInputs + bc->numOutputs, blockSize);
+    for (i = 0; i < bc->numInputs; i++) {
+        bench_input_fill(&bc->inputs[i], signals.signals[i].s_vec, blockSize);
+    }
+    stub_dsp(obj, &signals);
+    output = &signals.signals[bc->numInputs];
+    
+    if (bc->foldArgs) {
+        folder = stub_new("foldback~", bc->foldArgs);
+        if (!folder) {
+            stub_free(obj);
+            stub_signals_free(&signals);
+            return 0;
+        }
+        stub_signals_init(&fold, 3, blockSize);
+        bench_input_fill(&bc->threshold, fold.signals[1].s_vec, blockSize);
+        if (bc->drive.kind == BENCH_INPUT_CONSTANT) {
+            dsp_add(bench_scalar_times_perform, 4, output->s_vec, &gain, fold.signals[0].s_vec, (t_int)blockSize);
+        } else {
+            drive = (t_sample *)malloc(blockSize * sizeof(t_sample));
+            bench_input_fill(&bc->drive, drive, blockSize);
+            dsp_add(bench_times_perform, 4, output->s_vec, drive, fold.signals[0].s_vec, (t_int)blockSize);
+        }
+        stub_dsp_append(folder, &fold);
+        output = &fold.signals[2];
+    }
+
+    /* Warm up for a tenth of a trial, which also tells how many ticks a trial needs. */
+    warmup = 0;
+    start = bench_now_ns();
+    do {
+        stub_tick();
+        warmup++;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < trialNs * 0.1 && warmup < 100000000L);
+    ticks = (long)(warmup * trialNs / (elapsed > 1. ? elapsed : 1.) * 10.);
+    if (ticks < 1) {
+        ticks = 1;
+    }
+
+    if (numTrials > BENCH_TRIALS_MAX) {
+        numTrials = BENCH_TRIALS_MAX;
+    }
+    for (trial = 0; trial < numTrials; trial++) {
+        double startCycles = bench_cycles();
+        start = bench_now_ns();
+        for (t = 0; t < ticks; t++) {
+            stub_tick();
+        }
+        ns[trial] = (bench_now_ns() - start) / ((double)ticks * blockSize);
+        cycles[trial] = (startCycles < 0. ? -1. : (bench_cycles() - startCycles) / ((double)ticks * blockSize));
+        sorted[trial] = ns[trial];
+    }
+
+    qsort(sorted, numTrials, sizeof(double), bench_compare_doubles);
+    result->nsPerSample = sorted[numTrials / 2];
+    result->nsPerSampleMin = sorted[0];
+    result->cyclesPerSample = -1.;
+    for (trial = 0; trial < numTrials; trial++) {
+        if (ns[trial] == result->nsPerSample) {
+            result->cyclesPerSample = cycles[trial];
+            break;
+        }
+    }
+
+    result->finite = 1;
+    for (i = 0; i < bc->numOutputs; i++) {
+        int n;
+        for (n = 0; n < blockSize; n++) {
+            if (!isfinite(output[i].s_vec[n])) {
+                result->finite = 0;
+            }
+        }
+    }
+
+    if (folder) {
+        stub_free(folder);
+        stub_signals_free(&fold);
+        free(drive);
+    }
+    stub_free(obj);
+    stub_signals_free(&signals);
+    return 1;
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+typedef struct _bench_baseline {
+    char name[64];
+    int blockSize;
+    double nsPerSample;
+} bench_baseline_t;
+
+/* Reads the results from an earlier run's JSON, which has one result per line. */
+static int
+bench_baseline_load (const char* path, bench_baseline_t** baseline) {
+    FILE *file = fopen(path, "r");
+    char line[1024];
+    int count = 0, capacity = 0;
+    *baseline = NULL;
+    if (!file) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        bench_baseline_t entry;
+        const char *name = strstr(line, "\"case\": \"");
+        const char *block = strstr(line, "\"block\": ");
+        const char *ns = strstr(line, "\"ns_per_sample\": ");
+        if (!name || !block || !ns || sscanf(name + 9, "%63[^\"]", entry.name) != 1
+            || sscanf(block + 9, "%d", &entry.blockSize) != 1 || sscanf(ns + 17, "%lf", &entry.nsPerSample) != 1) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = (capacity ? capacity * 2 : 64);
+            *baseline = (bench_baseline_t *)realloc(*baseline, capacity * sizeof(bench_baseline_t));
+        }
+        (*baseline)[count++] = entry;
+    }
+    fclose(file);
+    return count;
+}
+
+static const bench_baseline_t*
+bench_baseline_find (const bench_baseline_t* baseline, int count, const char* name, int blockSize) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (baseline[i].blockSize == blockSize && strcmp(baseline[i].name, name) == 0) {
+            return &baseline[i];
+        }
+    }
+    return NULL;
+}
+
+static const char*
+bench_simd_name (void) {
+    int features = cpu_features();
+#if PD_FLOATSIZE == 32
+    if (features & CPU_FEATURE_AVX2) {
+        return "avx2";
+    }
+    if (features & CPU_FEATURE_SSE2) {
+        return "sse2";
+    }
+    if (features & CPU_FEATURE_NEON) {
+        return "neon";
+    }
+#endif
+    (void)features;
+    return "scalar";
+}
+
+static void
+bench_usage (const char* program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --blocks N,N,...  block sizes to run (default 1,8,64,256,1024,4096)\n"
+            "  --filter TEXT     only run cases whose name contains TEXT\n"
+            "  --time MS         length of a trial in milliseconds (default 20)\n"
+            "  --trials N        trials per result; the median is reported (default 5)\n"
+            "  --quick           one short trial at block sizes 1, 64 and 4096\n"
+            "  --output FILE     write the JSON to FILE instead of standard output\n"
+            "  --baseline FILE   compare with the JSON of an earlier run on standard error\n"
+            "  --list            list the cases and exit\n"
+            "  --verbose         show what the objects post\n",
+            program);
+}
+
+int
+main (int argc, char** argv) {
+    int blocks[BENCH_BLOCKS_MAX];
+    int numBlocks = 0;
+    const char *filter = NULL, *outputPath = NULL, *baselinePath = NULL;
+    double trialMs = 20.;
+    int numTrials = 5;
+    bench_baseline_t *baseline = NULL;
+    int numBaseline = 0;
+    FILE *out = stdout;
+    int c, b, i, first = 1, failures = 0;
+
+    for (i = 0; i < (int)(sizeof(bench_default_blocks) / sizeof(int)); i++) {
+        blocks[numBlocks++] = bench_default_blocks[i];
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc) {
+            char *text = argv[++i];
+            numBlocks = 0;
+            while (*text && numBlocks < BENCH_BLOCKS_MAX) {
+                int blockSize = (int)strtol(text, &text, 10);
+                if (blockSize > 0) {
+                    blocks[numBlocks++] = blockSize;
+                }
+                if (*text == ',') {
+                    text++;
+                } else if (*text) {
+                    break;
+                }
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            trialMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+            numTrials = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            numBlocks = 0;
+            for (b = 0; b < (int)(sizeof(bench_quick_blocks) / sizeof(int)); b++) {
+                blocks[numBlocks++] = bench_quick_blocks[b];
+            }
+            trialMs = 1.;
+            numTrials = 1;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (c = 0; c < BENCH_NUM_CASES; c++) {
+                printf("%-24s %s %s\n", bench_cases[c].name, bench_cases[c].className, bench_cases[c].args);
+            }
+            return 0;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            stub_set_verbose(1);
+        } else {
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (numTrials < 1) {
+        numTrials = 1;
+    }
+    if (trialMs <= 0.) {
+        trialMs = 1.;
+    }
+
+    if (baselinePath) {
+        numBaseline = bench_baseline_load(baselinePath, &baseline);
+        if (numBaseline < 0) {
+            fprintf(stderr, "bench: cannot read baseline '%s'\n", baselinePath);
+            return 2;
+        }
+    }
+    if (outputPath) {
+        out = fopen(outputPath, "w");
+        if (!out) {
+            fprintf(stderr, "bench: cannot write '%s'\n", outputPath);
+            return 2;
+        }
+    }
+
+    stub_set_samplerate(BENCH_SAMPLE_RATE);
+#ifdef BENCH_LIBRARY
+    pd_externals_setup();
+#else
+    polyblep_tilde_setup();
+    foldback_tilde_setup();
+    blepfold_tilde_setup();
+#endif
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"schema\": %d,\n", BENCH_SCHEMA);
+    fprintf(out, "  \"float_size\": %d,\n", PD_FLOATSIZE);
+    fprintf(out, "  \"simd\": \"%s\",\n", bench_simd_name());
+    fprintf(out, "  \"sample_rate\": %g,\n", BENCH_SAMPLE_RATE);
+    fprintf(out, "  \"trial_ms\": %g,\n", trialMs);
+    fprintf(out, "  \"trials\": %d,\n", numTrials);
+    fprintf(out, "  \"results\": [\n");
+    if (baseline) {
+        fprintf(stderr, "%-24s %6s %12s %12s %8s\n", "case", "block", "baseline", "ns/sample", "change");
+    }
+
+    for (c = 0; c < BENCH_NUM_CASES; c++) {
+        const bench_case_t *bc = &bench_cases[c];
+        if (filter && !strstr(bc->name, filter)) {
+            continue;
+        }
+        for (b = 0; b < numBlocks; b++) {
+            bench_result_t result;
+            if (!bench_run(bc, blocks[b], trialMs * 1e6, numTrials, &result)) {
+                fprintf(stderr, "bench: cannot create '%s %s'\n", bc->className, bc->args);
+                failures++;
+                break;
+            }
+            if (!result.finite) {
+                fprintf(stderr, "bench: %s produced non-finite output at block size %d\n", bc->name, blocks[b]);
+                failures++;
+            }
+            fprintf(out, "%s    {\"case\": \"%s\", \"object\": \"%s\", \"args\": \"%s\", \"block\": %d, "
+                    "\"ns_per_sample\": %.4f, \"ns_per_sample_min\": %.4f, ",
+                    first ? "" : ",\n", bc->name, bc->className, bc->args, blocks[b],
+                    result.nsPerSample, result.nsPerSampleMin);
+            if (result.cyclesPerSample >= 0.) {
+                fprintf(out, "\"cycles_per_sample\": %.4f, ", result.cyclesPerSample);
+            } else {
+                fprintf(out, "\"cycles_per_sample\": null, ");
+            }
+            fprintf(out, "\"msamples_per_sec\": %.3f, \"realtime_factor\": %.1f}",
+                    1e3 / result.nsPerSample, 1e9 / (result.nsPerSample * BENCH_SAMPLE_RATE));
+            first = 0;
+            if (baseline) {
+                const bench_baseline_t *previous = bench_baseline_find(baseline, numBaseline, bc->name, blocks[b]);
+                if (previous) {
+                    fprintf(stderr, "%-24s %6d %12.4f %12.4f %+7.1f%%\n", bc->name, blocks[b], previous->nsPerSample,
+                            result.nsPerSample, (result.nsPerSample / previous->nsPerSample - 1.) * 100.);
+                } else {
+                    fprintf(stderr, "%-24s %6d %12s %12.4f %8s\n", bc->name, blocks[b], "-", result.nsPerSample, "new");
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(baseline);
+    return (failures ? 1 : 0);
+}
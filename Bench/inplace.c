@@ -0,0 +1,227 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  In-place processing check. Pd hands an object's outlets the buffers of its inlet signals once
+//  nothing else reads them, so a perform routine has to read all of its inputs before it writes over
+//  them. Each case is rendered twice through the Pd stub, once with a buffer per signal and once
+//  with the outputs sharing the inputs' buffers the way Pd shares them, and the two renders have to
+//  be the same sample for sample.
+//
+
+#include "pd_stub.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPLACE_SAMPLE_RATE 48000.f
+#define INPLACE_BLOCK 64
+#define INPLACE_BLOCKS 200
+#define INPLACE_INPUTS_MAX 8
+#define INPLACE_TWOPI 6.283185307179586
+
+void polyblep_tilde_setup (void);
+void foldback_tilde_setup (void);
+void blepfold_tilde_setup (void);
+
+typedef struct _inplace_input {
+    double offset;
+    double amplitude; /* offset + amplitude * sin(2 pi frequency t); a constant without amplitude. */
+    double frequency;
+} inplace_input_t;
+
+typedef struct _inplace_case {
+    const char *name;
+    const char *className;
+    const char *args;
+    const char *message; /* Sent a quarter of the way through the render, or NULL. */
+    int numOutputs;
+    int numInputs;
+    inplace_input_t inputs[INPLACE_INPUTS_MAX];
+    int numChannels[INPLACE_INPUTS_MAX]; /* Channels of each input in the multichannel build; 0 for one. */
+} inplace_case_t;
+
+#define INPLACE_CONSTANT(value) { (value), 0., 0. }
+#define INPLACE_SINE(offset, amplitude, frequency) { (offset), (amplitude), (frequency) }
+#define INPLACE_FOLDBACK_INPUT INPLACE_SINE(0., 1.5, 110.)
+
+static const inplace_case_t inplace_cases[] = {
+    { "polyblep_saw", "polyblep~", "440", NULL, 1, 3,
+      { INPLACE_SINE(440., 220., 5.), INPLACE_CONSTANT(0.), INPLACE_CONSTANT(0.5) } },
+    { "foldback", "foldback~", "0.5", NULL, 1, 2, { INPLACE_FOLDBACK_INPUT, INPLACE_CONSTANT(0.5) } },
+    { "foldback_threshold_mod", "foldback~", "0.5", NULL, 1, 2,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0.5, 0.2, 3.) } },
+    { "foldback_stages2_adaa1_threshold_mod", "foldback~", "0.5 -stages 2 1.5 -adaa 1", NULL, 1, 2,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0.5, 0.2, 3.) } },
+    { "foldback_stages2_adaa2_glide", "foldback~", "0.5 -stages 2 1.5 -adaa 2 -smooth 20", "threshold 0.3", 1, 2,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_CONSTANT(0.5) } },
+    { "foldback_gain_adaa1_threshold_mod", "foldback~", "0.5 -stages 1 1.5 0.1 -adaa 1", NULL, 1, 2,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0.5, 0.2, 3.) } },
+    { "foldback_channels2", "foldback~", "0.5 -channels 2", NULL, 2, 3,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0., 1.5, 220.), INPLACE_CONSTANT(0.5) } },
+    { "foldback_channels3_threshold_mod", "foldback~", "0.5 -channels 3", NULL, 3, 4,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0., 1.5, 220.), INPLACE_SINE(0., 1.5, 330.),
+        INPLACE_SINE(0.5, 0.2, 3.) } },
+    { "foldback_channels3_glide", "foldback~", "0.5 -channels 3 -smooth 20", "threshold 0.3 0.4 0.6", 3, 4,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0., 1.5, 220.), INPLACE_SINE(0., 1.5, 330.),
+        INPLACE_CONSTANT(0.5) } },
+    { "foldback_channels2_adaa1_os2", "foldback~", "0.5 -channels 2 -adaa 1 -os 2", NULL, 2, 3,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0., 1.5, 220.), INPLACE_SINE(0.5, 0.2, 3.) } },
+    { "blepfold", "blepfold~", "440 2 0.4", NULL, 1, 1, { INPLACE_SINE(440., 220., 5.) } },
+#ifdef CLASS_MULTICHANNEL
+    { "polyblep_voices3_mc", "polyblep~", "440 -voices 3 -mc", NULL, 1, 3,
+      { INPLACE_SINE(440., 220., 5.), INPLACE_CONSTANT(0.), INPLACE_CONSTANT(0.5) } },
+    { "foldback_mc3", "foldback~", "0.5", NULL, 1, 2, { INPLACE_FOLDBACK_INPUT, INPLACE_CONSTANT(0.5) }, { 3 } },
+    { "foldback_mc3_threshold_mc3_adaa1", "foldback~", "0.5 -adaa 1", NULL, 1, 2,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_SINE(0.5, 0.2, 3.) }, { 3, 3 } },
+    { "foldback_mc2_threshold_mc2_glide", "foldback~", "0.5 -smooth 20", "threshold 0.3", 1, 2,
+      { INPLACE_FOLDBACK_INPUT, INPLACE_CONSTANT(0.5) }, { 2, 2 } },
+#endif
+};
+
+#define INPLACE_NUM_CASES ((int)(sizeof(inplace_cases) / sizeof(inplace_cases[0])))
+
+/* Fills block 'block' of an input; the inputs are written again before every block, as the outputs of
+ the last one may have been written over them. Each further channel runs at a multiple of the frequency. */
+static void
+inplace_input_fill (const inplace_input_t* input, t_sample* vec, int numChannels, int block) {
+    int c, i;
+    for (c = 0; c < numChannels; c++) {
+        for (i = 0; i < INPLACE_BLOCK; i++) {
+            double t = (double)(block * INPLACE_BLOCK + i) / INPLACE_SAMPLE_RATE;
+            vec[c * INPLACE_BLOCK + i] = (t_sample)(input->offset
+                                                    + input->amplitude * sin(INPLACE_TWOPI * input->frequency * (c + 1) * t));
+        }
+    }
+}
+
+static int
+inplace_channels (const t_signal* signal) {
+#ifdef CLASS_MULTICHANNEL
+    return signal->s_nchans;
+#else
+    return 1;
+#endif
+}
+
+/* Renders a case into 'render', INPLACE_BLOCKS blocks of each output channel one after another, with the
+ outputs sharing the inputs' buffers if 'reuse' is set. Returns the number of output channels, or 0 if the
+ object could not be created. */
+static int
+inplace_run (const inplace_case_t* ic, int reuse, t_sample* render) {
+    stub_signals_t signals;
+    t_pd *obj = stub_new(ic->className, ic->args);
+    int numChannels = 0;
+    int block, i, c;
+
+    if (!obj) {
+        return 0;
+    }
+    stub_signals_init(&signals, ic->numInputs + ic->numOutputs, INPLACE_BLOCK);
+#ifdef CLASS_MULTICHANNEL
+    for (i = 0; i < ic->numInputs; i++) {
+        signal_setmultiout(&signals.pointers[i], ic->numChannels[i]);
+    }
+#endif
+    if (reuse) {
+        stub_signals_reuse(&signals, ic->numInputs);
+    }
+    stub_dsp(obj, &signals);
+
+    for (block = 0; block < INPLACE_BLOCKS; block++) {
+        if (ic->message && block == INPLACE_BLOCKS / 4) {
+            const char *space = strchr(ic->message, ' ');
+            char selector[64];
+            int length = (int)(space ? space - ic->message : strlen(ic->message));
+            snprintf(selector, sizeof(selector), "%.*s", length, ic->message);
+            stub_send(obj, selector, space ? space + 1 : "");
+        }
+        for (i = 0; i < ic->numInputs; i++) {
+            inplace_input_fill(&ic->inputs[i], signals.signals[i].s_vec, inplace_channels(&signals.signals[i]), block);
+        }
+        stub_tick();
+        numChannels = 0;
+        for (i = 0; i < ic->numOutputs; i++) {
+            const t_signal *output = &signals.signals[ic->numInputs + i];
+            for (c = 0; c < inplace_channels(output) && numChannels < INPLACE_INPUTS_MAX; c++, numChannels++) {
+                memcpy(render + ((long)numChannels * INPLACE_BLOCKS + block) * INPLACE_BLOCK,
+                       output->s_vec + c * INPLACE_BLOCK, INPLACE_BLOCK * sizeof(t_sample));
+            }
+        }
+    }
+
+    stub_free(obj);
+    stub_signals_free(&signals);
+    return numChannels;
+}
+
+int
+main (int argc, char** argv) {
+    long length = (long)INPLACE_INPUTS_MAX * INPLACE_BLOCKS * INPLACE_BLOCK;
+    t_sample *separate = (t_sample *)malloc(length * sizeof(t_sample));
+    t_sample *shared = (t_sample *)malloc(length * sizeof(t_sample));
+    int failures = 0;
+    int c;
+
+    stub_set_samplerate(INPLACE_SAMPLE_RATE);
+    polyblep_tilde_setup();
+    foldback_tilde_setup();
+    blepfold_tilde_setup();
+
+    for (c = 0; c < INPLACE_NUM_CASES; c++) {
+        const inplace_case_t *ic = &inplace_cases[c];
+        int numChannels;
+        long numSamples;
+        double worst = 0.;
+        long worstAt = 0;
+        long n;
+
+        if (argc > 1 && !strstr(ic->name, argv[1])) {
+            continue;
+        }
+        numChannels = inplace_run(ic, 0, separate);
+        if (!numChannels || inplace_run(ic, 1, shared) != numChannels) {
+            fprintf(stderr, "inplace: cannot create '%s %s'\n", ic->className, ic->args);
+            failures++;
+            continue;
+        }
+        numSamples = (long)numChannels * INPLACE_BLOCKS * INPLACE_BLOCK;
+        for (n = 0; n < numSamples; n++) {
+            double difference = fabs((double)separate[n] - (double)shared[n]);
+            if (!(difference <= worst)) {
+                worst = difference;
+                worstAt = n;
+            }
+        }
+        if (worst != 0.) {
+            fprintf(stderr, "INPLACE MISMATCH: %s: output channel %ld differs by %g at block %ld, sample %ld\n", ic->name,
+                    worstAt / (INPLACE_BLOCKS * INPLACE_BLOCK), worst, worstAt / INPLACE_BLOCK % INPLACE_BLOCKS,
+                    worstAt % INPLACE_BLOCK);
+            failures++;
+        } else {
+            printf("%-36s ok\n", ic->name);
+        }
+    }
+
+    free(separate);
+    free(shared);
+    return (failures ? 1 : 0);
+}
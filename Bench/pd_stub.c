@@ -0,0 +1,658 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#include "pd_stub.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STUB_CLASSES_MAX 16
+#define STUB_METHODS_MAX 32
+#define STUB_ARGS_MAX 64
+#define STUB_CHAIN_MAX 4096
+
+typedef struct _stub_method {
+    t_symbol *selector;
+    t_method function;
+    t_atomtype args[MAXPDARG + 1];
+} stub_method_t;
+
+struct _class {
+    t_symbol *name;
+    t_newmethod newMethod;
+    t_method freeMethod;
+    size_t size;
+    t_atomtype newArgs[MAXPDARG + 1];
+    stub_method_t methods[STUB_METHODS_MAX];
+    int numMethods;
+    t_method floatMethod;
+};
+
+/* Inlets and outlets are never connected to anything here; they only need to exist. */
+struct _inlet {
+    int unused;
+};
+
+struct _outlet {
+    int unused;
+};
+
+struct _clock {
+    void *owner;
+    t_method method;
+};
+
+t_symbol s_pointer = { "pointer", 0, 0 };
+t_symbol s_float = { "float", 0, 0 };
+t_symbol s_symbol = { "symbol", 0, 0 };
+t_symbol s_bang = { "bang", 0, 0 };
+t_symbol s_list = { "list", 0, 0 };
+t_symbol s_anything = { "anything", 0, 0 };
+t_symbol s_signal = { "signal", 0, 0 };
+t_symbol s__N = { "#N", 0, 0 };
+t_symbol s__X = { "#X", 0, 0 };
+t_symbol s_x = { "x", 0, 0 };
+t_symbol s_y = { "y", 0, 0 };
+t_symbol s_ = { "", 0, 0 };
+
+int canvas_dspstate = 1;
+
+static t_symbol *stub_symbols = NULL;
+static int stub_symbols_seeded = 0;
+
+static t_class stub_classes[STUB_CLASSES_MAX];
+static int stub_num_classes = 0;
+
+static t_int stub_chain[STUB_CHAIN_MAX];
+static int stub_chain_size = 0;
+static int stub_block_size = 64;
+
+static t_float stub_sample_rate = 48000.f;
+static double stub_time = 0.; /* Logical time, in samples. */
+static int stub_verbose = 0;
+static int stub_errors = 0;
+
+/* ---------------------------------------------------------------------------------------- */
+
+t_symbol*
+gensym (const char* name) {
+    t_symbol *sym;
+    if (!stub_symbols_seeded) {
+        t_symbol *builtins[] = { &s_pointer, &s_float, &s_symbol, &s_bang, &s_list, &s_anything, &s_signal,
+                                 &s__N, &s__X, &s_x, &s_y, &s_ };
+        size_t i;
+        for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+            builtins[i]->s_next = stub_symbols;
+            stub_symbols = builtins[i];
+        }
+        stub_symbols_seeded = 1;
+    }
+    for (sym = stub_symbols; sym; sym = sym->s_next) {
+        if (strcmp(sym->s_name, name) == 0) {
+            return sym;
+        }
+    }
+    sym = (t_symbol *)calloc(1, sizeof(t_symbol));
+    sym->s_name = (char *)malloc(strlen(name) + 1);
+    strcpy(sym->s_name, name);
+    sym->s_next = stub_symbols;
+    stub_symbols = sym;
+    return sym;
+}
+
+void*
+getbytes (size_t numBytes) {
+    return calloc(1, numBytes ? numBytes : 1);
+}
+
+void*
+resizebytes (void* old, size_t oldSize, size_t newSize) {
+    void *memory = realloc(old, newSize ? newSize : 1);
+    if (memory && newSize > oldSize) {
+        memset((char *)memory + oldSize, 0, newSize - oldSize);
+    }
+    return memory;
+}
+
+void
+freebytes (void* memory, size_t numBytes) {
+    free(memory);
+}
+
+void
+post (const char* fmt, ...) {
+    va_list args;
+    if (stub_verbose) {
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+        fputc('\n', stderr);
+    }
+}
+
+void
+pd_error (void* object, const char* fmt, ...) {
+    va_list args;
+    stub_errors++;
+    if (stub_verbose) {
+        fputs("error: ", stderr);
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+        fputc('\n', stderr);
+    }
+}
+
+t_float
+atom_getfloat (t_atom* atom) {
+    return (atom->a_type == A_FLOAT ? atom->a_w.w_float : 0.f);
+}
+
+t_float
+atom_getfloatarg (int which, int argc, t_atom* argv) {
+    return (which < argc ? atom_getfloat(&argv[which]) : 0.f);
+}
+
+t_symbol*
+atom_getsymbol (t_atom* atom) {
+    return (atom->a_type == A_SYMBOL ? atom->a_w.w_symbol : &s_float);
+}
+
+double
+clock_getlogicaltime (void) {
+    return stub_time;
+}
+
+double
+clock_gettimesincewithunits (double prevTime, double units, int sampflag) {
+    if (sampflag) {
+        return (stub_time - prevTime) / units;
+    }
+    return (stub_time - prevTime) * 1000. / stub_sample_rate / units;
+}
+
+t_clock*
+clock_new (void* owner, t_method fn) {
+    t_clock *clock = (t_clock *)calloc(1, sizeof(t_clock));
+    clock->owner = owner;
+    clock->method = fn;
+    return clock;
+}
+
+/* There is no scheduler to wait for, so a clock goes off as soon as it is set. */
+void
+clock_delay (t_clock* clock, double delayTime) {
+    ((void (*)(void *))clock->method)(clock->owner);
+}
+
+void
+clock_free (t_clock* clock) {
+    free(clock);
+}
+
+t_float
+sys_getsr (void) {
+    return stub_sample_rate;
+}
+
+int
+sys_getblksize (void) {
+    return stub_block_size;
+}
+
+void
+canvas_update_dsp (void) {
+}
+
+/* Objects are not in a patch, so file names are taken as they are. */
+t_glist*
+canvas_getcurrent (void) {
+    return NULL;
+}
+
+void
+canvas_makefilename (t_glist* c, char* file, char* result, int resultsize) {
+    strncpy(result, file, resultsize);
+    result[resultsize - 1] = 0;
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+static void
+stub_argtypes (t_atomtype* types, t_atomtype first, va_list args) {
+    int i = 0;
+    t_atomtype type = first;
+    while (type != A_NULL && i < MAXPDARG) {
+        types[i++] = type;
+        type = (t_atomtype)va_arg(args, int);
+    }
+    types[i] = A_NULL;
+}
+
+t_class*
+class_new (t_symbol* name, t_newmethod newMethod, t_method freeMethod, size_t size, int flags, t_atomtype arg1, ...) {
+    t_class *c;
+    va_list args;
+    if (stub_num_classes == STUB_CLASSES_MAX) {
+        return NULL;
+    }
+    c = &stub_classes[stub_num_classes++];
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->newMethod = newMethod;
+    c->freeMethod = freeMethod;
+    c->size = size;
+    va_start(args, arg1);
+    stub_argtypes(c->newArgs, arg1, args);
+    va_end(args);
+    return c;
+}
+
+void
+class_addmethod (t_class* c, t_method fn, t_symbol* sel, t_atomtype arg1, ...) {
+    stub_method_t *method;
+    va_list args;
+    if (!c || c->numMethods == STUB_METHODS_MAX) {
+        return;
+    }
+    method = &c->methods[c->numMethods++];
+    method->selector = sel;
+    method->function = fn;
+    va_start(args, arg1);
+    stub_argtypes(method->args, arg1, args);
+    va_end(args);
+}
+
+void
+class_doaddfloat (t_class* c, t_method fn) {
+    if (c) {
+        c->floatMethod = fn;
+    }
+}
+
+void
+class_domainsignalin (t_class* c, int onset) {
+}
+
+char*
+class_getname (t_class* c) {
+    return c->name->s_name;
+}
+
+/* Only one object can be bound to a symbol here. */
+void
+pd_bind (t_pd* x, t_symbol* s) {
+    s->s_thing = x;
+}
+
+t_pd*
+pd_new (t_class* c) {
+    t_pd *obj = (t_pd *)calloc(1, c->size);
+    *obj = c;
+    return obj;
+}
+
+t_inlet*
+inlet_new (t_object* owner, t_pd* dest, t_symbol* s1, t_symbol* s2) {
+    return (t_inlet *)calloc(1, sizeof(t_inlet));
+}
+
+t_inlet*
+floatinlet_new (t_object* owner, t_float* fp) {
+    return (t_inlet *)calloc(1, sizeof(t_inlet));
+}
+
+t_inlet*
+signalinlet_new (t_object* owner, t_float f) {
+    return (t_inlet *)calloc(1, sizeof(t_inlet));
+}
+
+void
+inlet_free (t_inlet* inlet) {
+    free(inlet);
+}
+
+t_outlet*
+outlet_new (t_object* owner, t_symbol* s) {
+    return (t_outlet *)calloc(1, sizeof(t_outlet));
+}
+
+void
+outlet_free (t_outlet* outlet) {
+    free(outlet);
+}
+
+/* Outlets are not connected, so whatever an object sends out goes nowhere. */
+void
+outlet_float (t_outlet* outlet, t_float f) {
+}
+
+void
+outlet_list (t_outlet* outlet, t_symbol* s, int argc, t_atom* argv) {
+}
+
+void
+outlet_anything (t_outlet* outlet, t_symbol* s, int argc, t_atom* argv) {
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+static void
+stub_chain_append (t_int value) {
+    if (stub_chain_size < STUB_CHAIN_MAX - 1) {
+        stub_chain[stub_chain_size++] = value;
+        stub_chain[stub_chain_size] = 0;
+    }
+}
+
+void
+dsp_add (t_perfroutine f, int n, ...) {
+    va_list args;
+    int i;
+    stub_chain_append((t_int)f);
+    va_start(args, n);
+    for (i = 0; i < n; i++) {
+        stub_chain_append(va_arg(args, t_int));
+    }
+    va_end(args);
+}
+
+void
+dsp_addv (t_perfroutine f, int n, t_int* vec) {
+    int i;
+    stub_chain_append((t_int)f);
+    for (i = 0; i < n; i++) {
+        stub_chain_append(vec[i]);
+    }
+}
+
+t_int*
+copy_perform (t_int* args) {
+    memcpy((t_sample *)args[2], (t_sample *)args[1], (int)args[3] * sizeof(t_sample));
+    return (args + 4);
+}
+
+void
+dsp_add_copy (t_sample* in, t_sample* out, int n) {
+    dsp_add(copy_perform, 3, in, out, (t_int)n);
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+void
+stub_set_samplerate (t_float sampleRate) {
+    stub_sample_rate = sampleRate;
+}
+
+void
+stub_set_verbose (int verbose) {
+    stub_verbose = verbose;
+}
+
+int
+stub_error_count (void) {
+    return stub_errors;
+}
+
+static t_class*
+stub_class_find (const char* name) {
+    t_symbol *sym = gensym(name);
+    int i;
+    for (i = 0; i < stub_num_classes; i++) {
+        if (stub_classes[i].name == sym) {
+            return &stub_classes[i];
+        }
+    }
+    return NULL;
+}
+
+/* Splits 'text' at white space into atoms; words that read as numbers become floats. */
+static int
+stub_parse (const char* text, t_atom* atoms, int maxAtoms) {
+    char word[256];
+    int argc = 0;
+    while (text && *text && argc < maxAtoms) {
+        int length = 0;
+        char *end;
+        double value;
+        while (*text == ' ' || *text == '\t') {
+            text++;
+        }
+        while (*text && *text != ' ' && *text != '\t') {
+            if (length < (int)sizeof(word) - 1) {
+                word[length++] = *text;
+            }
+            text++;
+        }
+        if (length == 0) {
+            break;
+        }
+        word[length] = '\0';
+        value = strtod(word, &end);
+        if (*end == '\0') {
+            SETFLOAT(&atoms[argc], (t_float)value);
+        } else {
+            SETSYMBOL(&atoms[argc], gensym(word));
+        }
+        argc++;
+    }
+    return argc;
+}
+
+/* Collects typed arguments the way Pd's pd_typedmess does: symbols into 'ints', floats into
+ 'floats', with missing defaults filled in. Returns the number of symbol arguments. */
+static int
+stub_collect (const t_atomtype* types, int argc, t_atom* argv, t_int* ints, t_floatarg* floats) {
+    int numInts = 0, numFloats = 0, i = 0;
+    memset(floats, 0, sizeof(t_floatarg) * MAXPDARG);
+    for (; *types != A_NULL; types++, i++) {
+        switch (*types) {
+            case A_FLOAT:
+            case A_DEFFLOAT:
+                floats[numFloats++] = (i < argc ? atom_getfloat(&argv[i]) : 0.f);
+                break;
+            case A_SYMBOL:
+            case A_DEFSYM:
+                ints[numInts++] = (t_int)(i < argc && argv[i].a_type == A_SYMBOL ? argv[i].a_w.w_symbol : &s_);
+                break;
+            default:
+                break;
+        }
+    }
+    return numInts;
+}
+
+typedef void* (*stub_new_gimme)(t_symbol*, int, t_atom*);
+typedef void* (*stub_new_floats)(t_floatarg, t_floatarg, t_floatarg, t_floatarg, t_floatarg);
+typedef void (*stub_method_gimme)(t_pd*, t_symbol*, int, t_atom*);
+typedef void (*stub_method_0)(t_pd*, t_floatarg, t_floatarg, t_floatarg, t_floatarg, t_floatarg);
+typedef void (*stub_method_1)(t_pd*, t_int, t_floatarg, t_floatarg, t_floatarg, t_floatarg, t_floatarg);
+typedef void (*stub_method_2)(t_pd*, t_int, t_int, t_floatarg, t_floatarg, t_floatarg, t_floatarg, t_floatarg);
+typedef void (*stub_method_dsp)(t_pd*, t_signal**);
+
+t_pd*
+stub_new (const char* className, const char* args) {
+    t_class *c = stub_class_find(className);
+    t_atom argv[STUB_ARGS_MAX];
+    int argc;
+    if (!c) {
+        return NULL;
+    }
+    argc = stub_parse(args, argv, STUB_ARGS_MAX);
+    if (c->newArgs[0] == A_GIMME) {
+        return (t_pd *)((stub_new_gimme)c->newMethod)(c->name, argc, argv);
+    } else {
+        t_int ints[MAXPDARG];
+        t_floatarg floats[MAXPDARG];
+        stub_collect(c->newArgs, argc, argv, ints, floats);
+        return (t_pd *)((stub_new_floats)c->newMethod)(floats[0], floats[1], floats[2], floats[3], floats[4]);
+    }
+}
+
+int
+stub_send (t_pd* obj, const char* selector, const char* args) {
+    t_class *c = *obj;
+    t_symbol *sel = gensym(selector);
+    t_atom argv[STUB_ARGS_MAX];
+    int argc = stub_parse(args, argv, STUB_ARGS_MAX);
+    int i;
+    for (i = 0; i < c->numMethods; i++) {
+        stub_method_t *method = &c->methods[i];
+        t_int ints[MAXPDARG];
+        t_floatarg floats[MAXPDARG];
+        if (method->selector != sel) {
+            continue;
+        }
+        if (method->args[0] == A_GIMME) {
+            ((stub_method_gimme)method->function)(obj, sel, argc, argv);
+            return 1;
+        }
+        switch (stub_collect(method->args, argc, argv, ints, floats)) {
+            case 0:
+                ((stub_method_0)method->function)(obj, floats[0], floats[1], floats[2], floats[3], floats[4]);
+                break;
+            case 1:
+                ((stub_method_1)method->function)(obj, ints[0], floats[0], floats[1], floats[2], floats[3], floats[4]);
+                break;
+            default:
+                ((stub_method_2)method->function)(obj, ints[0], ints[1], floats[0], floats[1], floats[2], floats[3],
+                                                  floats[4]);
+                break;
+        }
+        return 1;
+    }
+    if (sel == &s_float && c->floatMethod && argc > 0) {
+        ((stub_method_0)c->floatMethod)(obj, atom_getfloat(&argv[0]), 0.f, 0.f, 0.f, 0.f);
+        return 1;
+    }
+    return 0;
+}
+
+void
+stub_free (t_pd* obj) {
+    t_class *c = *obj;
+    if (c->freeMethod) {
+        ((void (*)(t_pd*))c->freeMethod)(obj);
+    }
+    free(obj);
+}
+
+void
+stub_signals_init (stub_signals_t* signals, int numSignals, int blockSize) {
+    int i;
+    memset(signals, 0, sizeof(*signals));
+    signals->numSignals = (numSignals > PD_STUB_SIGNALS_MAX ? PD_STUB_SIGNALS_MAX : numSignals);
+    for (i = 0; i < signals->numSignals; i++) {
+        t_signal *signal = &signals->signals[i];
+        signal->s_n = blockSize;
+        signal->s_vecsize = blockSize;
+        signal->s_sr = stub_sample_rate;
+        signal->s_refcount = 1;
+#ifdef CLASS_MULTICHANNEL
+        signal->s_nchans = 1;
+#endif
+        signal->s_vec = (t_sample *)calloc(blockSize, sizeof(t_sample));
+        signals->pointers[i] = signal;
+    }
+}
+
+void
+stub_signals_reuse (stub_signals_t* signals, int numInputs) {
+    int i;
+    for (i = numInputs; i < signals->numSignals && i < 2 * numInputs; i++) {
+        free(signals->signals[i].s_vec);
+        signals->signals[i].s_vec = signals->signals[2 * numInputs - 1 - i].s_vec;
+        signals->signals[i].s_vecsize = signals->signals[2 * numInputs - 1 - i].s_vecsize;
+        signals->signals[i].s_isborrowed = 1;
+    }
+}
+
+#ifdef CLASS_MULTICHANNEL
+void
+signal_setmultiout (t_signal** sig, int nchans) {
+    t_signal *signal = *sig;
+    if (nchans < 1) {
+        nchans = 1;
+    }
+    if (signal->s_n * nchans > signal->s_vecsize) {
+        if (!signal->s_isborrowed) {
+            free(signal->s_vec);
+        }
+        signal->s_vecsize = signal->s_n * nchans;
+        signal->s_vec = (t_sample *)calloc(signal->s_vecsize, sizeof(t_sample));
+        signal->s_isborrowed = 0;
+    }
+    signal->s_nchans = nchans;
+}
+#endif
+
+void
+stub_signals_free (stub_signals_t* signals) {
+    int i, j;
+    for (i = 0; i < signals->numSignals; i++) {
+        /* Outputs that took over an input's buffer do not own it. */
+        for (j = 0; j < i; j++) {
+            if (signals->signals[j].s_vec == signals->signals[i].s_vec) {
+                break;
+            }
+        }
+        if (j == i) {
+            free(signals->signals[i].s_vec);
+        }
+    }
+    memset(signals, 0, sizeof(*signals));
+}
+
+int
+stub_dsp (t_pd* obj, stub_signals_t* signals) {
+    stub_chain_size = 0;
+    stub_chain[0] = 0;
+    return stub_dsp_append(obj, signals);
+}
+
+int
+stub_dsp_append (t_pd* obj, stub_signals_t* signals) {
+    t_class *c = *obj;
+    t_symbol *sel = gensym("dsp");
+    int i;
+    if (signals->numSignals > 0) {
+        stub_block_size = signals->signals[0].s_n;
+    }
+    for (i = 0; i < c->numMethods; i++) {
+        if (c->methods[i].selector == sel) {
+            ((stub_method_dsp)c->methods[i].function)(obj, signals->pointers);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* As in Pd, logical time moves on by a block before the block is computed. */
+void
+stub_tick (void) {
+    t_int *pc = stub_chain;
+    stub_time += stub_block_size;
+    while (*pc) {
+        pc = (*(t_perfroutine)(*pc))(pc);
+    }
+}
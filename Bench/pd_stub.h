@@ -0,0 +1,80 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  A minimal stand-in for the parts of the Pd runtime the externals use, so that their perform
+//  routines can be driven outside of Pd. Objects are created and sent messages through the
+//  methods their classes register, and the DSP chain is built and run the way Pd does it.
+//
+
+#ifndef PD_STUB_H
+#define PD_STUB_H
+
+#include "m_pd.h"
+
+#define PD_STUB_SIGNALS_MAX 32
+
+/* The signals handed to an object's dsp method, inputs first, then outputs. */
+typedef struct _stub_signals {
+    t_signal signals[PD_STUB_SIGNALS_MAX];
+    t_signal *pointers[PD_STUB_SIGNALS_MAX];
+    int numSignals;
+} stub_signals_t;
+
+/* Sample rate reported by sys_getsr() and put in the signals. Defaults to 48000. */
+void stub_set_samplerate (t_float sampleRate);
+
+/* Whether post() and pd_error() print (to stderr). Off by default. */
+void stub_set_verbose (int verbose);
+
+/* Number of pd_error() calls so far. */
+int stub_error_count (void);
+
+/* Creates an object of the class called 'className' from a creation argument string such as
+ "440 -os 4", as if it were typed into an object box. Returns NULL if there is no such class. */
+t_pd* stub_new (const char* className, const char* args);
+
+/* Sends 'selector args' to the object. Returns 0 if its class has no such method. */
+int stub_send (t_pd* obj, const char* selector, const char* args);
+
+/* Calls the free method and releases the object. */
+void stub_free (t_pd* obj);
+
+/* Allocates 'numSignals' zeroed signals of 'blockSize' samples at the stub's sample rate. */
+void stub_signals_init (stub_signals_t* signals, int numSignals, int blockSize);
+void stub_signals_free (stub_signals_t* signals);
+
+/* Gives the outputs (the signals after the first 'numInputs') the inputs' buffers, as Pd does: an
+ object's input signals are released before its outputs are made, and the buffers are reused last in,
+ first out, so the first output gets the last input's buffer, the second the one before it, and so on.
+ Outputs beyond the number of inputs keep their own. In the multichannel test build (pd_stub_multichannel.h),
+ inputs are given more channels with signal_setmultiout() before this. */
+void stub_signals_reuse (stub_signals_t* signals, int numInputs);
+
+/* Clears the DSP chain and calls the object's dsp method with the signals, which adds its
+ perform routines to the chain. Returns 0 if the object has no dsp method. */
+int stub_dsp (t_pd* obj, stub_signals_t* signals);
+
+/* As stub_dsp, but adds to the perform routines already in the chain, to run several objects in a row. */
+int stub_dsp_append (t_pd* obj, stub_signals_t* signals);
+
+/* Runs the DSP chain once, i.e. processes one block. */
+void stub_tick (void);
+
+#endif /* PD_STUB_H */
@@ -0,0 +1,59 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//
+//  Multichannel signals for the stub. The bundled m_pd.h is Pd 0.45's, which predates them, so the
+//  externals' CLASS_MULTICHANNEL paths are not compiled against it. This header is force-included
+//  (-include, /FI) ahead of every source of the multichannel test build and declares what Pd 0.54
+//  added for them: a channel count in t_signal, the class flag and signal_setmultiout(). The build is
+//  never loaded into Pd, so only the stub and the externals have to agree on the layout.
+//
+
+#ifndef PD_STUB_MULTICHANNEL_H
+#define PD_STUB_MULTICHANNEL_H
+
+/* Pd 0.45's t_signal goes by another name, so that the one with a channel count can take its place. */
+#define _signal _stub_signal_mono
+#define t_signal t_stub_signal_mono
+#include "m_pd.h"
+#undef _signal
+#undef t_signal
+
+typedef struct _signal
+{
+    int s_n;            /* number of points in each channel */
+    t_sample *s_vec;    /* the array, one channel after another */
+    t_float s_sr;       /* sample rate */
+    int s_nchans;       /* number of channels */
+    int s_refcount;
+    int s_isborrowed;   /* whether the array belongs to another signal */
+    struct _signal *s_borrowedfrom;
+    struct _signal *s_nextfree;
+    struct _signal *s_nextused;
+    int s_vecsize;      /* allocated size of array in points */
+} t_signal;
+
+#define CLASS_MULTICHANNEL 0x40
+
+/* Gives an output 'nchans' channels, keeping its array if it is big enough (which may be an input's, as
+ in Pd) and allocating one otherwise. */
+EXTERN void signal_setmultiout(t_signal **sig, int nchans);
+
+#endif /* PD_STUB_MULTICHANNEL_H */
@@ -0,0 +1,497 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Alias and noise energy against CPU cost. Each case renders a sweep through the real perform
+//  routines (via the Pd stub): oscillators over third-octave frequencies from 20 Hz to 20 kHz, the
+//  folder over a grid of drives and thresholds. Every render is analysed for the energy that is
+//  neither harmonic nor DC, split into aliases and everything else (noise), and checked against
+//  the golden reference measurements so that a quality regression fails the run. Aliases are given
+//  both below Nyquist and below 20 kHz: oversampling leaves some in the band above 20 kHz, where
+//  the half-band filters' transition lies.
+//
+//  Frequencies are rounded to an odd number of cycles per analysis length. A periodic signal then
+//  has its harmonics exactly on bins, and since the length is a power of two, no alias (a harmonic
+//  reflected at Nyquist) lands on a harmonic bin, which lets the two be told apart exactly.
+//
+
+#include "pd_stub.h"
+#include "spectrum.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#define QUALITY_SAMPLE_RATE 48000.
+#define QUALITY_LENGTH 65536 /* Analysis length. */
+#define QUALITY_SKIP 8192 /* Samples rendered before the analysis, past any filter latency or start-up. */
+#define QUALITY_BLOCK 64
+#define QUALITY_FOLDS 64 /* Aliases are tracked up to this many times the sample rate. */
+#define QUALITY_AUDIBLE 20000. /* Upper edge of the band the audible alias figure covers, in Hz. */
+#define QUALITY_FLOOR_DB -120. /* Measurements are clamped to this, below which they only reflect rounding. */
+#define QUALITY_TOLERANCE_DB 1.
+#define QUALITY_ROUNDING_DB -100. /* Below this, differences from the golden reference are down to rounding (and so
+                                   to compiler, instruction set and sample type) and are not regressions. */
+#define QUALITY_POINTS_MAX 64
+
+void polyblep_tilde_setup (void);
+void foldback_tilde_setup (void);
+void blepfold_tilde_setup (void);
+
+typedef enum {
+    QUALITY_SWEEP_FREQUENCY = 0, /* An oscillator; the point sets the frequency. */
+    QUALITY_SWEEP_FOLD /* A sine through a folder; the point sets drive (amplitude) and threshold. */
+} quality_sweep_t;
+
+typedef struct _quality_case {
+    const char *name;
+    const char *className;
+    const char *args; /* Creation arguments, with %g for the frequency or threshold. */
+    quality_sweep_t sweep;
+    int numInputs; /* Signal inputs, which come before the output. */
+} quality_case_t;
+
+static const quality_case_t quality_cases[] = {
+    { "polyblep_saw", "polyblep~", "%g", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_saw_quality1", "polyblep~", "%g -quality 1", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_saw_quality2", "polyblep~", "%g -quality 2", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_saw_wavetable", "polyblep~", "%g -wavetable", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_saw_os2", "polyblep~", "%g -os 2", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_saw_os4", "polyblep~", "%g -os 4", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_saw_os8", "polyblep~", "%g -os 8", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_square", "polyblep~", "%g -shape square", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "polyblep_triangle", "polyblep~", "%g -shape triangle", QUALITY_SWEEP_FREQUENCY, 3 },
+    { "foldback", "foldback~", "%g", QUALITY_SWEEP_FOLD, 2 },
+    { "foldback_adaa1", "foldback~", "%g -adaa 1", QUALITY_SWEEP_FOLD, 2 },
+    { "foldback_adaa2", "foldback~", "%g -adaa 2", QUALITY_SWEEP_FOLD, 2 },
+    { "foldback_stages2", "foldback~", "%g -stages 2 1.5", QUALITY_SWEEP_FOLD, 2 },
+    { "foldback_os2", "foldback~", "%g -os 2", QUALITY_SWEEP_FOLD, 2 },
+    { "foldback_os4", "foldback~", "%g -os 4", QUALITY_SWEEP_FOLD, 2 },
+    { "foldback_os8", "foldback~", "%g -os 8", QUALITY_SWEEP_FOLD, 2 },
+    { "blepfold", "blepfold~", "%g 2 0.4", QUALITY_SWEEP_FREQUENCY, 1 },
+};
+
+#define QUALITY_NUM_CASES ((int)(sizeof(quality_cases) / sizeof(quality_cases[0])))
+
+/* Nominal third-octave centre frequencies from 20 Hz to 20 kHz. */
+static const double quality_frequencies[] = {
+    20., 25., 31.5, 40., 50., 63., 80., 100., 125., 160., 200., 250., 315., 400., 500., 630., 800.,
+    1000., 1250., 1600., 2000., 2500., 3150., 4000., 5000., 6300., 8000., 10000., 12500., 16000., 20000.
+};
+
+#define QUALITY_NUM_FREQUENCIES ((int)(sizeof(quality_frequencies) / sizeof(quality_frequencies[0])))
+
+/* The folder sweep drives a 1 kHz sine at each of these amplitudes into each threshold. */
+#define QUALITY_FOLD_FREQUENCY 1000.
+static const double quality_drives[] = { 1.5, 3., 6. };
+static const double quality_thresholds[] = { 0.25, 0.5, 0.8 };
+
+#define QUALITY_NUM_DRIVES ((int)(sizeof(quality_drives) / sizeof(quality_drives[0])))
+#define QUALITY_NUM_THRESHOLDS ((int)(sizeof(quality_thresholds) / sizeof(quality_thresholds[0])))
+
+typedef struct _quality_point {
+    char label[32];
+    double frequency; /* Nominal. */
+    double drive;
+    double threshold;
+} quality_point_t;
+
+typedef struct _quality_measure {
+    double aliasDb; /* Alias energy below Nyquist relative to the total, clamped to QUALITY_FLOOR_DB. */
+    double audibleDb; /* Alias energy below QUALITY_AUDIBLE relative to the total. */
+    double noiseDb; /* Energy that is neither harmonic, alias nor DC, relative to the total. */
+    double nsPerSample;
+} quality_measure_t;
+
+typedef struct _quality_golden {
+    char name[64];
+    char label[32];
+    double aliasDb;
+    double audibleDb;
+    double noiseDb;
+} quality_golden_t;
+
+/* ---------------------------------------------------------------------------------------- */
+
+static double
+quality_now_ns (void) {
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+static int
+quality_points (const quality_case_t* qc, quality_point_t* points) {
+    int numPoints = 0, d, t;
+    if (qc->sweep == QUALITY_SWEEP_FREQUENCY) {
+        for (numPoints = 0; numPoints < QUALITY_NUM_FREQUENCIES; numPoints++) {
+            quality_point_t *point = &points[numPoints];
+            point->frequency = quality_frequencies[numPoints];
+            point->drive = 1.;
+            point->threshold = 1.;
+            snprintf(point->label, sizeof(point->label), "f=%g", point->frequency);
+        }
+    } else {
+        for (d = 0; d < QUALITY_NUM_DRIVES; d++) {
+            for (t = 0; t < QUALITY_NUM_THRESHOLDS; t++) {
+                quality_point_t *point = &points[numPoints++];
+                point->frequency = QUALITY_FOLD_FREQUENCY;
+                point->drive = quality_drives[d];
+                point->threshold = quality_thresholds[t];
+                snprintf(point->label, sizeof(point->label), "d=%g,t=%g", point->drive, point->threshold);
+            }
+        }
+    }
+    return numPoints;
+}
+
+/* Cycles per analysis length for 'frequency': the nearest odd number. */
+static int
+quality_cycles (double frequency) {
+    int cycles = (int)floor(frequency * QUALITY_LENGTH / QUALITY_SAMPLE_RATE + 0.5);
+    return (cycles % 2 == 0 ? cycles + 1 : cycles);
+}
+
+static int
+quality_fold_bin (long bin) {
+    bin %= QUALITY_LENGTH;
+    return (int)(bin > QUALITY_LENGTH / 2 ? QUALITY_LENGTH - bin : bin);
+}
+
+static void
+quality_mark (char* mask, int bin, char value) {
+    int b;
+    for (b = bin - SPECTRUM_LOBE; b <= bin + SPECTRUM_LOBE; b++) {
+        if (b >= 0 && b <= QUALITY_LENGTH / 2 && mask[b] == 0) {
+            mask[b] = value;
+        }
+    }
+}
+
+static double
+quality_db (double ratio) {
+    double db = (ratio > 0. ? 10. * log10(ratio) : QUALITY_FLOOR_DB);
+    return (db < QUALITY_FLOOR_DB ? QUALITY_FLOOR_DB : db);
+}
+
+/* Splits the spectrum of a render with 'cycles' periods into harmonic, alias and noise energy. */
+static void
+quality_analyse (const double* render, int cycles, quality_measure_t* measure) {
+    enum { OTHER = 0, HARMONIC, ALIAS };
+    int numBins = QUALITY_LENGTH / 2 + 1;
+    double *power = (double *)malloc(numBins * sizeof(double));
+    char *mask = (char *)calloc(numBins, 1);
+    int audibleBins = (int)(QUALITY_AUDIBLE * QUALITY_LENGTH / QUALITY_SAMPLE_RATE);
+    double total = 0., alias = 0., audible = 0., noise = 0.;
+    long m;
+    int b;
+
+    spectrum_power(render, QUALITY_LENGTH, power);
+
+    /* DC and the harmonics are marked first, so that alias marks never take their bins. */
+    quality_mark(mask, 0, HARMONIC);
+    for (m = 1; m * cycles <= QUALITY_LENGTH / 2; m++) {
+        quality_mark(mask, (int)(m * cycles), HARMONIC);
+    }
+    for (; m * cycles <= (long)QUALITY_FOLDS * QUALITY_LENGTH; m++) {
+        quality_mark(mask, quality_fold_bin(m * cycles), ALIAS);
+    }
+
+    for (b = SPECTRUM_LOBE + 1; b < numBins; b++) {
+        total += power[b];
+        if (mask[b] == ALIAS) {
+            alias += power[b];
+            if (b <= audibleBins) {
+                audible += power[b];
+            }
+        } else if (mask[b] == OTHER) {
+            noise += power[b];
+        }
+    }
+    measure->aliasDb = quality_db(total > 0. ? alias / total : 0.);
+    measure->audibleDb = quality_db(total > 0. ? audible / total : 0.);
+    measure->noiseDb = quality_db(total > 0. ? noise / total : 0.);
+
+    free(power);
+    free(mask);
+}
+
+/* Renders and analyses one point of a case. Returns 0 if the object could not be created. */
+static int
+quality_run (const quality_case_t* qc, const quality_point_t* point, quality_measure_t* measure) {
+    stub_signals_t signals;
+    char args[128];
+    t_pd *obj;
+    int cycles = quality_cycles(point->frequency);
+    double frequency = cycles * QUALITY_SAMPLE_RATE / QUALITY_LENGTH;
+    t_sample *input = NULL;
+    double *render = (double *)malloc(QUALITY_LENGTH * sizeof(double));
+    double elapsed = 0.;
+    long n;
+    int i;
+
+    snprintf(args, sizeof(args), qc->args, qc->sweep == QUALITY_SWEEP_FREQUENCY ? frequency : point->threshold);
+    obj = stub_new(qc->className, args);
+    if (!obj) {
+        free(render);
+        return 0;
+    }
+    stub_signals_init(&signals, qc->numInputs + 1, QUALITY_BLOCK);
+
+    if (qc->sweep == QUALITY_SWEEP_FREQUENCY) {
+        /* Frequency, then the sync (silent) and width inlets where there are any. */
+        for (i = 0; i < QUALITY_BLOCK; i++) {
+            signals.signals[0].s_vec[i] = (t_sample)frequency;
+            if (qc->numInputs > 2) {
+                signals.signals[2].s_vec[i] = 0.5f;
+            }
+        }
+    } else {
+        /* One period of the input repeats exactly over the analysis length. */
+        input = (t_sample *)malloc(QUALITY_LENGTH * sizeof(t_sample));
+        for (n = 0; n < QUALITY_LENGTH; n++) {
+            input[n] = (t_sample)(point->drive * sin(SPECTRUM_TWOPI * (double)cycles * n / QUALITY_LENGTH));
+        }
+        for (i = 0; i < QUALITY_BLOCK; i++) {
+            signals.signals[1].s_vec[i] = (t_sample)point->threshold;
+        }
+    }
+    stub_dsp(obj, &signals);
+
+    for (n = 0; n < QUALITY_SKIP + QUALITY_LENGTH; n += QUALITY_BLOCK) {
+        t_sample *out = signals.signals[qc->numInputs].s_vec;
+        double start;
+        if (input) {
+            memcpy(signals.signals[0].s_vec, input + n % QUALITY_LENGTH, QUALITY_BLOCK * sizeof(t_sample));
+        }
+        start = quality_now_ns();
+        stub_tick();
+        elapsed += quality_now_ns() - start;
+        if (n >= QUALITY_SKIP) {
+            for (i = 0; i < QUALITY_BLOCK; i++) {
+                render[n - QUALITY_SKIP + i] = out[i];
+            }
+        }
+    }
+
+    quality_analyse(render, cycles, measure);
+    measure->nsPerSample = elapsed / (QUALITY_SKIP + QUALITY_LENGTH);
+
+    stub_free(obj);
+    stub_signals_free(&signals);
+    free(input);
+    free(render);
+    return 1;
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+static int
+quality_golden_load (const char* path, quality_golden_t** golden) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+    int count = 0, capacity = 0;
+    *golden = NULL;
+    if (!file) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        quality_golden_t entry;
+        if (line[0] == '#' || sscanf(line, "%63s %31s %lf %lf %lf", entry.name, entry.label, &entry.aliasDb,
+                                     &entry.audibleDb, &entry.noiseDb) != 5) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = (capacity ? capacity * 2 : 256);
+            *golden = (quality_golden_t *)realloc(*golden, capacity * sizeof(quality_golden_t));
+        }
+        (*golden)[count++] = entry;
+    }
+    fclose(file);
+    return count;
+}
+
+static const quality_golden_t*
+quality_golden_find (const quality_golden_t* golden, int count, const char* name, const char* label) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (strcmp(golden[i].name, name) == 0 && strcmp(golden[i].label, label) == 0) {
+            return &golden[i];
+        }
+    }
+    return NULL;
+}
+
+/* Whether 'measured' is worse than 'golden' by more than 'tolerance'. */
+static int
+quality_worse (double measured, double golden, double tolerance) {
+    return (measured > (golden > QUALITY_ROUNDING_DB ? golden : QUALITY_ROUNDING_DB) + tolerance);
+}
+
+static void
+quality_usage (const char* program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --golden FILE     fail if any measurement is worse than in FILE\n"
+            "  --update FILE     write this run's measurements to FILE as the new golden reference\n"
+            "  --tolerance DB    how much worse than golden a measurement may be (default %g)\n"
+            "  --filter TEXT     only run cases whose name contains TEXT\n"
+            "  --points          print every point of every sweep, not just the summary\n"
+            "  --list            list the cases and exit\n",
+            program, QUALITY_TOLERANCE_DB);
+}
+
+int
+main (int argc, char** argv) {
+    const char *goldenPath = NULL, *updatePath = NULL, *filter = NULL;
+    double tolerance = QUALITY_TOLERANCE_DB;
+    int showPoints = 0;
+    quality_golden_t *golden = NULL;
+    int numGolden = 0, regressions = 0, missing = 0, failures = 0;
+    FILE *update = NULL;
+    int c, p, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenPath = argv[++i];
+        } else if (strcmp(argv[i], "--update") == 0 && i + 1 < argc) {
+            updatePath = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--points") == 0) {
+            showPoints = 1;
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (c = 0; c < QUALITY_NUM_CASES; c++) {
+                printf("%-24s %s %s\n", quality_cases[c].name, quality_cases[c].className, quality_cases[c].args);
+            }
+            return 0;
+        } else {
+            quality_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (goldenPath) {
+        numGolden = quality_golden_load(goldenPath, &golden);
+        if (numGolden < 0) {
+            fprintf(stderr, "quality: cannot read golden reference '%s'\n", goldenPath);
+            return 2;
+        }
+    }
+    if (updatePath) {
+        update = fopen(updatePath, "w");
+        if (!update) {
+            fprintf(stderr, "quality: cannot write '%s'\n", updatePath);
+            return 2;
+        }
+        fprintf(update, "# Golden reference for pd-externals-quality, written with --update.\n");
+        fprintf(update, "# case point alias_db alias_audible_db noise_db (relative to the total energy, floor %g dB)\n", QUALITY_FLOOR_DB);
+    }
+
+    stub_set_samplerate((t_float)QUALITY_SAMPLE_RATE);
+    polyblep_tilde_setup();
+    foldback_tilde_setup();
+    blepfold_tilde_setup();
+
+    printf("%-24s %10s %11s %11s %11s %11s %11s  %s\n", "case", "ns/sample", "alias mean", "alias worst",
+           "<20k mean", "<20k worst", "noise worst", "worst at");
+    for (c = 0; c < QUALITY_NUM_CASES; c++) {
+        const quality_case_t *qc = &quality_cases[c];
+        quality_point_t points[QUALITY_POINTS_MAX];
+        int numPoints = quality_points(qc, points);
+        double ns = 0., aliasSum = 0., audibleSum = 0.;
+        double aliasWorst = QUALITY_FLOOR_DB, audibleWorst = QUALITY_FLOOR_DB, noiseWorst = QUALITY_FLOOR_DB;
+        const char *worstLabel = "-";
+
+        if (filter && !strstr(qc->name, filter)) {
+            continue;
+        }
+        for (p = 0; p < numPoints; p++) {
+            quality_measure_t measure;
+            const quality_golden_t *reference;
+            if (!quality_run(qc, &points[p], &measure)) {
+                fprintf(stderr, "quality: cannot create '%s' (%s)\n", qc->className, qc->args);
+                failures++;
+                break;
+            }
+            ns += measure.nsPerSample / numPoints;
+            aliasSum += pow(10., measure.aliasDb / 10.);
+            audibleSum += pow(10., measure.audibleDb / 10.);
+            if (measure.aliasDb > aliasWorst) {
+                aliasWorst = measure.aliasDb;
+                worstLabel = points[p].label;
+            }
+            audibleWorst = (measure.audibleDb > audibleWorst ? measure.audibleDb : audibleWorst);
+            noiseWorst = (measure.noiseDb > noiseWorst ? measure.noiseDb : noiseWorst);
+            if (showPoints) {
+                printf("  %-22s %10.2f %11.2f %11s %11.2f %11s %11.2f\n", points[p].label, measure.nsPerSample,
+                       measure.aliasDb, "", measure.audibleDb, "", measure.noiseDb);
+            }
+            if (update) {
+                fprintf(update, "%s %s %.2f %.2f %.2f\n", qc->name, points[p].label, measure.aliasDb,
+                        measure.audibleDb, measure.noiseDb);
+            }
+            if (golden) {
+                reference = quality_golden_find(golden, numGolden, qc->name, points[p].label);
+                if (!reference) {
+                    missing++;
+                } else if (quality_worse(measure.aliasDb, reference->aliasDb, tolerance)
+                           || quality_worse(measure.audibleDb, reference->audibleDb, tolerance)
+                           || quality_worse(measure.noiseDb, reference->noiseDb, tolerance)) {
+                    fprintf(stderr, "QUALITY REGRESSION: %s %s: alias %.2f dB (golden %.2f), below 20 kHz %.2f dB "
+                            "(golden %.2f), noise %.2f dB (golden %.2f)\n", qc->name, points[p].label, measure.aliasDb,
+                            reference->aliasDb, measure.audibleDb, reference->audibleDb, measure.noiseDb,
+                            reference->noiseDb);
+                    regressions++;
+                }
+            }
+        }
+        printf("%-24s %10.2f %11.2f %11.2f %11.2f %11.2f %11.2f  %s\n", qc->name, ns, quality_db(aliasSum / numPoints),
+               aliasWorst, quality_db(audibleSum / numPoints), audibleWorst, noiseWorst, worstLabel);
+    }
+
+    if (update) {
+        fclose(update);
+    }
+    free(golden);
+    if (missing) {
+        fprintf(stderr, "quality: %d measurements have no golden reference; run with --update to add them\n", missing);
+    }
+    if (regressions) {
+        fprintf(stderr, "quality: %d measurements are worse than the golden reference by more than %g dB\n",
+                regressions, tolerance);
+    }
+    return (regressions || failures ? 1 : 0);
+}
@@ -0,0 +1,102 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Power spectrum of a real signal, for the quality suite. Gives the same spectrum as Pd's
+//  mayer_realfft (a radix-2 transform of a power-of-two length), computed in double precision so
+//  that the analysis adds no noise of its own to what is being measured.
+//
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <math.h>
+#include <stdlib.h>
+
+#define SPECTRUM_TWOPI 6.283185307179586
+
+/* In-place iterative radix-2 FFT of 'n' complex values, n a power of two. */
+static void
+spectrum_fft (double* re, double* im, int n) {
+    int i, j, length;
+
+    for (i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (length = 2; length <= n; length <<= 1) {
+        double angle = -SPECTRUM_TWOPI / length;
+        int half = length >> 1;
+        for (i = 0; i < n; i += length) {
+            int k;
+            for (k = 0; k < half; k++) {
+                double wr = cos(angle * k), wi = sin(angle * k);
+                double *ar = &re[i + k], *ai = &im[i + k];
+                double *br = &re[i + k + half], *bi = &im[i + k + half];
+                double tr = *br * wr - *bi * wi;
+                double ti = *br * wi + *bi * wr;
+                *br = *ar - tr;
+                *bi = *ai - ti;
+                *ar += tr;
+                *ai += ti;
+            }
+        }
+    }
+}
+
+/* 4-term Blackman-Harris window value at 'i' of 'n'. Side lobes are 92 dB down and the main lobe is
+ four bins wide on each side, so a component's energy stays within SPECTRUM_LOBE bins of it. */
+#define SPECTRUM_LOBE 4
+
+static double
+spectrum_window (int i, int n) {
+    double x = SPECTRUM_TWOPI * i / n;
+    return 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2. * x) - 0.01168 * cos(3. * x);
+}
+
+/* Writes the power in bins 0 to n/2 of the windowed signal into 'power' (n/2 + 1 values). */
+static void
+spectrum_power (const double* signal, int n, double* power) {
+    double *re = (double *)malloc(n * sizeof(double));
+    double *im = (double *)calloc(n, sizeof(double));
+    int i;
+    for (i = 0; i < n; i++) {
+        re[i] = signal[i] * spectrum_window(i, n);
+    }
+    spectrum_fft(re, im, n);
+    for (i = 0; i <= n / 2; i++) {
+        power[i] = re[i] * re[i] + im[i] * im[i];
+    }
+    free(re);
+    free(im);
+}
+
+#endif /* SPECTRUM_H */
@@ -0,0 +1,334 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  ----------------------------------------------------------------------------------------
+//
+//  Pure Data, Copyright (c) 1997-1999 Miller Puckette.
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms
+//  of the GNU General Public License as published by the Free Software Foundation, either
+//  version 3 of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+//  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//  See the  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along with this program.
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "m_pd.h" /* Pure Data API */
+#include "cpu_features.h"
+#include "foldback.h"
+#include "polyblep.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The chain polyblep~ -> *~ -> foldback~ as a single object: a PolyBLEP sawtooth, scaled by the drive and
+ folded back into [-threshold, threshold]. Each sample goes through all three while it is in a register, so
+ there are no intermediate blocks to write and read back. The saw runs on the integer phase accumulator
+ of polyblep~ -intphase, and both steps use the same math as the two externals (polyblep.h, foldback.h). */
+
+static t_class *blepfold_tilde_class;
+
+struct _blepfold_tilde {
+    t_object obj;
+    
+    t_float frequency;
+    t_float drive; /* Gain applied to the sawtooth before it is folded. */
+    t_float threshold;
+    t_float sampleRate;
+    uint32_t phase;
+    
+    t_inlet *driveInlet;
+    t_inlet *thresholdInlet;
+    t_outlet *signalOut;
+};
+
+typedef struct _blepfold_tilde blepfold_tilde_t;
+
+
+void*
+blepfold_tilde_new (t_floatarg frequency, t_floatarg drive, t_floatarg threshold) {
+    blepfold_tilde_t *obj = (blepfold_tilde_t *)pd_new(blepfold_tilde_class);
+    
+    /* Arguments: frequency (default 0), drive (default 1) and threshold (default 1). */
+    obj->frequency = frequency;
+    obj->drive = (drive == 0.f ? 1.f : drive);
+    obj->threshold = (threshold == 0.f ? 1.f : threshold);
+    obj->sampleRate = sys_getsr();
+    obj->phase = 0;
+    
+    obj->driveInlet = floatinlet_new(&obj->obj, &obj->drive);
+    obj->thresholdInlet = floatinlet_new(&obj->obj, &obj->threshold);
+    obj->signalOut = outlet_new(&obj->obj, &s_signal);
+    
+    return (void *)obj;
+}
+
+void
+blepfold_tilde_free (blepfold_tilde_t* obj) {
+    inlet_free(obj->driveInlet);
+    inlet_free(obj->thresholdInlet);
+    outlet_free(obj->signalOut);
+}
+
+/* Sets the phase in radians, clamped between 0 and TWOPI, as polyblep~'s phase message does. */
+void
+blepfold_phase (blepfold_tilde_t* obj, t_floatarg phase) {
+    phase = (phase < 0.f ? 0.f : (phase > TWOPI ? TWOPI : phase));
+    /* TWOPI itself maps to a full cycle, which the accumulator stores as 0. */
+    obj->phase = (uint32_t)(uint64_t)(phase / TWOPI * PHASE_RANGE);
+}
+
+/* Scalar kernel for a constant frequency, and the reference for the vectorized ones. A threshold of zero or
+ less gives silence, as it does for foldback~. */
+static void
+blepfold_process (t_sample* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, t_float normFreq,
+                  t_sample drive, t_sample threshold) {
+    t_float freq = (t_float)fabs(normFreq);
+    t_float invFreq = 1.f / freq;
+    uint32_t p = *phase;
+    
+    if (threshold <= 0.f) {
+        memset(out, 0, numSamples * sizeof(t_sample));
+        *phase = p + phaseIncr * (uint32_t)numSamples;
+        return;
+    }
+    while (numSamples--) {
+        t_sample saw = DSP_PD(polyblep_saw_sample)(DSP_PD(polyblep_phase_norm)(p), freq, invFreq);
+        *out++ = DSP_PD(foldback_sample)(drive * saw, threshold);
+        p += phaseIncr;
+    }
+    *phase = p;
+}
+
+/* Fold and peak kernels of foldback~ for the running CPU, chosen in blepfold_tilde_setup. */
+typedef void (*blepfold_fold_kernel_t)(const t_sample* in, t_sample* out, int numSamples, t_sample threshold);
+typedef t_sample (*blepfold_peak_kernel_t)(const t_sample* in, int numSamples, t_sample center, t_sample limit);
+
+static blepfold_fold_kernel_t blepfold_fold_kernel = DSP_PD(foldback_process);
+static blepfold_peak_kernel_t blepfold_peak_kernel = DSP_PD(foldback_peak_process);
+
+/* Audio-rate frequency, as polyblep_saw_int_fm. The saw has no vector kernel for this, but the fold, which
+ costs the most in scalar code, does: the driven saw is written out first and then folded in place. */
+static void
+blepfold_process_fm (t_sample* out, const t_sample* in, int numSamples, uint32_t* phase, t_float invSampleRate,
+                     t_sample drive, t_sample threshold) {
+    uint32_t p = *phase;
+    t_sample *saw = out;
+    int i;
+    
+    for (i = 0; i < numSamples; i++) {
+        t_float normFreq = in[i] * invSampleRate;
+        normFreq -= (t_float)(int)normFreq;
+        *saw++ = drive * DSP_PD(polyblep_saw_fm_sample)(DSP_PD(polyblep_phase_norm)(p), (t_float)fabs(normFreq));
+        p += DSP_PD(polyblep_phase_incr)(normFreq);
+    }
+    *phase = p;
+    blepfold_fold_kernel(out, out, numSamples, threshold);
+}
+
+/* The vectorized kernels are the integer phase sawtooth kernels of polyblep~ with the drive and the fold of
+ foldback~ applied to each vector before it is stored. */
+#if PD_FLOATSIZE == 32
+
+#if defined(CPU_X86)
+
+CPU_TARGET_SSE2 static void
+blepfold_process_sse2 (t_sample* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, t_float normFreq,
+                       t_sample drive, t_sample threshold) {
+    const float freqAbs = fabsf(normFreq);
+    const __m128 freq = _mm_set1_ps(freqAbs);
+    const __m128 edge = _mm_set1_ps(1.f - freqAbs);
+    const __m128 invFreq = _mm_set1_ps(1.f / freqAbs);
+    const __m128 scale = _mm_set1_ps(1.f / 16777216.f);
+    const __m128 gain = _mm_set1_ps(drive);
+    const __m128 th = _mm_set1_ps(threshold);
+    const __m128 inv4th = _mm_set1_ps(threshold > 0.f ? 0.25f / threshold : 0.f);
+    const __m128i vectorIncr = _mm_set1_epi32((int)(phaseIncr * 4u));
+    __m128i pv = _mm_add_epi32(_mm_set1_epi32((int)*phase),
+                               _mm_set_epi32((int)(phaseIncr * 3u), (int)(phaseIncr * 2u), (int)phaseIncr, 0));
+    uint32_t p = *phase;
+    
+    for (; numSamples >= 4; numSamples -= 4, out += 4) {
+        __m128 tv = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(pv, 8)), scale);
+        __m128 saw = _mm_mul_ps(polyblep_saw_lanes_sse2_f(tv, freq, edge, invFreq), gain);
+        _mm_storeu_ps(out, foldback_lanes_sse2_f(saw, th, inv4th));
+        pv = _mm_add_epi32(pv, vectorIncr);
+        p += phaseIncr * 4u;
+    }
+    
+    *phase = p;
+    blepfold_process(out, numSamples, phase, phaseIncr, normFreq, drive, threshold);
+}
+
+CPU_TARGET_AVX2 static void
+blepfold_process_avx2 (t_sample* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, t_float normFreq,
+                       t_sample drive, t_sample threshold) {
+    const float freqAbs = fabsf(normFreq);
+    const __m256 freq = _mm256_set1_ps(freqAbs);
+    const __m256 edge = _mm256_set1_ps(1.f - freqAbs);
+    const __m256 invFreq = _mm256_set1_ps(1.f / freqAbs);
+    const __m256 scale = _mm256_set1_ps(1.f / 16777216.f);
+    const __m256 gain = _mm256_set1_ps(drive);
+    const __m256 th = _mm256_set1_ps(threshold);
+    const __m256 inv4th = _mm256_set1_ps(threshold > 0.f ? 0.25f / threshold : 0.f);
+    const __m256i vectorIncr = _mm256_set1_epi32((int)(phaseIncr * 8u));
+    __m256i pv = _mm256_add_epi32(_mm256_set1_epi32((int)*phase),
+                                  _mm256_mullo_epi32(_mm256_set1_epi32((int)phaseIncr),
+                                                     _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)));
+    uint32_t p = *phase;
+    
+    for (; numSamples >= 8; numSamples -= 8, out += 8) {
+        __m256 tv = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(pv, 8)), scale);
+        __m256 saw = _mm256_mul_ps(polyblep_saw_lanes_avx2_f(tv, freq, edge, invFreq), gain);
+        _mm256_storeu_ps(out, foldback_lanes_avx2_f(saw, th, inv4th));
+        pv = _mm256_add_epi32(pv, vectorIncr);
+        p += phaseIncr * 8u;
+    }
+    
+    *phase = p;
+    /* The scalar code is not VEX-encoded; clear the upper halves first to avoid the SSE/AVX transition penalty. */
+    _mm256_zeroupper();
+    blepfold_process(out, numSamples, phase, phaseIncr, normFreq, drive, threshold);
+}
+
+#endif /* CPU_X86 */
+
+#if defined(CPU_NEON)
+
+static void
+blepfold_process_neon (t_sample* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, t_float normFreq,
+                       t_sample drive, t_sample threshold) {
+    static const uint32_t laneIndex[4] = { 0, 1, 2, 3 };
+    const float freqAbs = fabsf(normFreq);
+    const float32x4_t freq = vdupq_n_f32(freqAbs);
+    const float32x4_t edge = vdupq_n_f32(1.f - freqAbs);
+    const float32x4_t invFreq = vdupq_n_f32(1.f / freqAbs);
+    const float32x4_t th = vdupq_n_f32(threshold);
+    const float32x4_t inv4th = vdupq_n_f32(threshold > 0.f ? 0.25f / threshold : 0.f);
+    const uint32x4_t vectorIncr = vdupq_n_u32(phaseIncr * 4u);
+    uint32x4_t pv = vmlaq_n_u32(vdupq_n_u32(*phase), vld1q_u32(laneIndex), phaseIncr);
+    uint32_t p = *phase;
+    
+    for (; numSamples >= 4; numSamples -= 4, out += 4) {
+        float32x4_t tv = vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(pv, 8)), 1.f / 16777216.f);
+        float32x4_t saw = vmulq_n_f32(polyblep_saw_lanes_neon_f(tv, freq, edge, invFreq), drive);
+        vst1q_f32(out, foldback_lanes_neon_f(saw, th, inv4th));
+        pv = vaddq_u32(pv, vectorIncr);
+        p += phaseIncr * 4u;
+    }
+    
+    *phase = p;
+    blepfold_process(out, numSamples, phase, phaseIncr, normFreq, drive, threshold);
+}
+
+#endif /* CPU_NEON */
+
+#endif /* PD_FLOATSIZE == 32 */
+
+typedef void (*blepfold_kernel_t)(t_sample* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, t_float normFreq,
+                                  t_sample drive, t_sample threshold);
+
+/* Constant frequency kernel for the running CPU, chosen in blepfold_tilde_setup. */
+static blepfold_kernel_t blepfold_kernel = blepfold_process;
+
+/* The peak kernel stops at the first sample that differs from the first one. */
+static int
+blepfold_block_is_constant (const t_sample* in, int numSamples) {
+    return (blepfold_peak_kernel(in, numSamples, in[0], 0.f) == 0.f);
+}
+
+t_int*
+blepfold_perform (t_int* args) {
+    blepfold_tilde_t *obj = (blepfold_tilde_t *)args[1];
+    t_sample *in = (t_sample *)args[2];
+    t_sample *out = (t_sample *)args[3];
+    int numSamples = (int)args[4];
+    t_float sampleRate = obj->sampleRate;
+    
+    /* Input and output may share memory, so the frequency is read before anything is written. */
+    if (blepfold_block_is_constant(in, numSamples)) {
+        t_float normFreq = in[0] / sampleRate;
+        normFreq -= (t_float)(int)normFreq;
+        blepfold_kernel(out, numSamples, &obj->phase, DSP_PD(polyblep_phase_incr)(normFreq), normFreq, obj->drive,
+                        obj->threshold);
+    } else {
+        blepfold_process_fm(out, in, numSamples, &obj->phase, 1.f / sampleRate, obj->drive, obj->threshold);
+    }
+    
+    /* Return requirement from documentation specifies that the function must return a pointer
+     to the memory directly behind the arguments list (in this case, the number of arguments given (4)
+     plus 1). */
+    return (args + 5);
+}
+
+void
+blepfold_dsp (blepfold_tilde_t* obj, t_signal** sp) {
+    /* Signal pointer (sp) has the frequency inlet (0) and the signal outlet (1). */
+    obj->sampleRate = sp[0]->s_sr;
+    dsp_add(blepfold_perform, 4, obj, sp[0]->s_vec, sp[1]->s_vec, sp[0]->s_n);
+}
+
+void
+blepfold_tilde_setup (void) {
+    blepfold_tilde_class = class_new(gensym("blepfold~"),
+                                     (t_newmethod)blepfold_tilde_new,
+                                     (t_method)blepfold_tilde_free,
+                                     sizeof(blepfold_tilde_t),
+                                     CLASS_DEFAULT,
+                                     A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
+    
+    class_addmethod(blepfold_tilde_class, (t_method)blepfold_dsp, gensym("dsp"), 0);
+    class_addmethod(blepfold_tilde_class, (t_method)blepfold_phase, gensym("phase"), A_FLOAT, 0);
+    /* Float messages to the left inlet set the frequency. */
+    CLASS_MAINSIGNALIN(blepfold_tilde_class, blepfold_tilde_t, frequency);
+    
+#if defined(CPU_X86)
+    if (cpu_features() & CPU_FEATURE_AVX2) {
+        blepfold_fold_kernel = DSP_PD(foldback_process_avx2);
+        blepfold_peak_kernel = DSP_PD(foldback_peak_avx2);
+    } else if (cpu_features() & CPU_FEATURE_SSE2) {
+        blepfold_fold_kernel = DSP_PD(foldback_process_sse2);
+        blepfold_peak_kernel = DSP_PD(foldback_peak_sse2);
+    }
+#elif defined(CPU_NEON) && (PD_FLOATSIZE == 32 || defined(SIMD_NEON_F64))
+    if (cpu_features() & CPU_FEATURE_NEON) {
+        blepfold_fold_kernel = DSP_PD(foldback_process_neon);
+        blepfold_peak_kernel = DSP_PD(foldback_peak_neon);
+    }
+#endif
+#if PD_FLOATSIZE == 32
+# if defined(CPU_X86)
+    if (cpu_features() & CPU_FEATURE_AVX2) {
+        blepfold_kernel = blepfold_process_avx2;
+    } else if (cpu_features() & CPU_FEATURE_SSE2) {
+        blepfold_kernel = blepfold_process_sse2;
+    }
+# elif defined(CPU_NEON)
+    if (cpu_features() & CPU_FEATURE_NEON) {
+        blepfold_kernel = blepfold_process_neon;
+    }
+# endif
+#endif
+}
@@ -0,0 +1,295 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  A CPU budget shared by the externals' DSP in the whole process. Objects that are adaptive time
+//  their blocks into one account, which is closed once per DSP tick and compared with the tick's
+//  duration (sys_getblksize() samples at sys_getsr()). When the smoothed load goes over the
+//  budget, the quality level goes up a step and every adaptive object switches to cheaper
+//  settings of its own (lower BLEP order, a lower oversampling factor, less or no ADAA). The level
+//  comes back down a step at a time when the load has stayed well under the budget. Each switch
+//  is posted and kept in a short log, which the 'budget' message posts along with the load.
+//
+//  The account is only touched by perform routines and message handlers, which Pd never runs at
+//  the same time. Objects that are not adaptive add nothing to their DSP chain, and the account
+//  is only created once an object is adaptive in a chain or is sent 'budget'.
+//
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "m_pd.h"
+#include "profiler.h" /* profiler_now_ns */
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+# define BUDGET_INLINE __inline
+#else
+# define BUDGET_INLINE inline
+#endif
+
+#define BUDGET_NAME "pd-externals-budget"
+#define BUDGET_VERSION (1)
+#define BUDGET_DEFAULT (50.f) /* Percent of each tick the adaptive objects may use together. */
+#define BUDGET_LEVEL_MAX (4) /* Levels past the first halve oversampling, so 8x is down to 1x at the last. */
+#define BUDGET_SMOOTHING_MS (50.) /* Time constant of the load the decisions are made on. */
+#define BUDGET_HOLD_DOWN_MS (250.) /* Least time between two switches to a cheaper level. */
+#define BUDGET_HOLD_UP_MS (2000.) /* Least time after any switch before going back up to a better one. */
+#define BUDGET_RESTORE (0.6) /* Part of the budget the load has to be under to go back up. */
+#define BUDGET_LOG_SIZE (16) /* Switches kept for the 'budget' message. */
+
+/* One switch of the quality level. */
+struct _budget_switch {
+    double time; /* Logical time of the switch. */
+    int from;
+    int to;
+    float load; /* Smoothed load that caused it, in percent. */
+};
+
+typedef struct _budget_switch budget_switch_t;
+
+/* The account is shared by every object in the process. Unless the externals are built as the single
+ library, each one is its own binary with its own copy of this header, so the first to need the account
+ creates it and binds it to BUDGET_NAME, where the others find it (as profiler.h does for the trace). */
+struct _budget {
+    t_pd pd;
+    int version;
+    t_float percent; /* The budget, as a percentage of each tick. */
+    int level; /* 0 for the settings the objects were given, up to BUDGET_LEVEL_MAX. */
+    double tickTime; /* Logical time of the tick being accounted, -1 before the first. */
+    double used; /* Nanoseconds the adaptive objects took in that tick. */
+    double load; /* Smoothed used / tick duration, in percent. */
+    double lastSwitch; /* Logical time of the last switch. */
+    budget_switch_t log[BUDGET_LOG_SIZE]; /* Ring of the latest switches, the newest at numSwitches - 1. */
+    int numSwitches;
+    int numPosted; /* Switches posted so far; they are posted from a clock, not the perform routine. */
+    t_clock *postClock;
+};
+
+typedef struct _budget budget_t;
+
+/* Puts the owner's settings in line with a quality level. Called between blocks. */
+typedef void (*budget_adapt_t)(void* owner, int level);
+
+/* The part of an object that takes part in the budget. */
+struct _budget_client {
+    budget_t *budget; /* NULL until the object is first adaptive in a DSP chain or sent 'budget'. */
+    int adaptive; /* Whether the object's blocks are timed and its settings follow the level. */
+    int level; /* Level the owner's settings were last adapted to. */
+    budget_adapt_t adapt;
+    void *owner;
+    double start; /* When the block being timed started. */
+};
+
+typedef struct _budget_client budget_client_t;
+
+static void
+budget_post_switches (budget_t* budget) {
+    int first = budget->numSwitches - BUDGET_LOG_SIZE;
+    int i;
+    for (i = (budget->numPosted > first ? budget->numPosted : first); i < budget->numSwitches; i++) {
+        const budget_switch_t *entry = &budget->log[i % BUDGET_LOG_SIZE];
+        post("%s: load %.1f%% of a %g%% budget, quality level %d -> %d", BUDGET_NAME, entry->load,
+             budget->percent, entry->from, entry->to);
+    }
+    budget->numPosted = budget->numSwitches;
+}
+
+static budget_t*
+budget_get (void) {
+    static budget_t *budget = NULL;
+    t_symbol *sym;
+    
+    if (budget) {
+        return budget;
+    }
+    sym = gensym(BUDGET_NAME);
+    if (sym->s_thing && strcmp(class_getname(*sym->s_thing), BUDGET_NAME) == 0
+        && ((budget_t *)sym->s_thing)->version == BUDGET_VERSION) {
+        budget = (budget_t *)sym->s_thing;
+    } else {
+        /* Without a new method the class cannot be created from a patch; it only holds the account. */
+        t_class *budgetClass = class_new(sym, 0, 0, sizeof(budget_t), CLASS_PD, 0);
+        budget = (budget_t *)pd_new(budgetClass);
+        budget->version = BUDGET_VERSION;
+        budget->percent = BUDGET_DEFAULT;
+        budget->level = 0;
+        budget->tickTime = -1.;
+        budget->used = 0.;
+        budget->load = 0.;
+        budget->lastSwitch = clock_getlogicaltime();
+        budget->numSwitches = budget->numPosted = 0;
+        budget->postClock = clock_new(budget, (t_method)budget_post_switches);
+        pd_bind(&budget->pd, sym);
+    }
+    return budget;
+}
+
+static void
+budget_switch (budget_t* budget, int level) {
+    budget_switch_t *entry = &budget->log[budget->numSwitches % BUDGET_LOG_SIZE];
+    entry->time = clock_getlogicaltime();
+    entry->from = budget->level;
+    entry->to = level;
+    entry->load = (float)budget->load;
+    budget->numSwitches++;
+    budget->level = level;
+    budget->lastSwitch = entry->time;
+    clock_delay(budget->postClock, 0.);
+}
+
+/* Closes the account of the last tick: smooths its load in and moves the level if the load calls for it. */
+static void
+budget_close_tick (budget_t* budget) {
+    double tickNs = 1e9 * sys_getblksize() / sys_getsr();
+    double sinceSwitch = clock_gettimesincewithunits(budget->lastSwitch, 1., 0);
+    double smoothing;
+    
+    if (!(tickNs > 0.)) {
+        return;
+    }
+    smoothing = 1. - exp(-tickNs * 1e-6 / BUDGET_SMOOTHING_MS);
+    budget->load += (100. * budget->used / tickNs - budget->load) * smoothing;
+    if (budget->load > budget->percent && budget->level < BUDGET_LEVEL_MAX
+        && sinceSwitch >= BUDGET_HOLD_DOWN_MS) {
+        budget_switch(budget, budget->level + 1);
+    } else if (budget->load < budget->percent * BUDGET_RESTORE && budget->level > 0
+               && sinceSwitch >= BUDGET_HOLD_UP_MS) {
+        budget_switch(budget, budget->level - 1);
+    }
+}
+
+static t_int*
+budget_begin (t_int* args) {
+    budget_client_t *client = (budget_client_t *)args[1];
+    if (client->level != client->budget->level) {
+        client->level = client->budget->level;
+        client->adapt(client->owner, client->level);
+    }
+    client->start = profiler_now_ns();
+    return args + 2;
+}
+
+static t_int*
+budget_end (t_int* args) {
+    budget_client_t *client = (budget_client_t *)args[1];
+    budget_t *budget = client->budget;
+    double elapsed = profiler_now_ns() - client->start;
+    double now = clock_getlogicaltime();
+    
+    if (now != budget->tickTime) {
+        if (budget->tickTime >= 0.) {
+            budget_close_tick(budget);
+        }
+        budget->tickTime = now;
+        budget->used = 0.;
+    }
+    budget->used += elapsed;
+    return args + 2;
+}
+
+/* Sets up the client of an object, which follows the budget if 'adaptive' is set. 'adapt' is called with
+ the level whenever it changes while the object is adaptive, and with 0 when it stops being adaptive. */
+static void
+budget_client_init (budget_client_t* client, void* owner, budget_adapt_t adapt, int adaptive) {
+    client->budget = NULL;
+    client->adaptive = adaptive;
+    client->level = 0;
+    client->adapt = adapt;
+    client->owner = owner;
+    client->start = 0.;
+}
+
+/* Handles 'adaptive 0/1'. The timing routines are added to the DSP chain or taken out of it, so it is
+ rebuilt. */
+static void
+budget_client_set_adaptive (budget_client_t* client, int adaptive) {
+    if (adaptive == client->adaptive) {
+        return;
+    }
+    client->adaptive = adaptive;
+    if (!adaptive && client->level != 0) {
+        client->level = 0;
+        client->adapt(client->owner, 0);
+    }
+    canvas_update_dsp();
+}
+
+/* Puts the object's perform routines, added between these two calls in its dsp method, between the timing
+ routines if the object is adaptive. The account is only looked up (or created and bound) here, so objects
+ that never take part leave no trace of it. */
+static void
+budget_dsp_begin (budget_client_t* client) {
+    if (client->adaptive) {
+        if (!client->budget) {
+            client->budget = budget_get();
+        }
+        dsp_add(budget_begin, 1, client);
+    }
+}
+
+static void
+budget_dsp_end (budget_client_t* client) {
+    if (client->adaptive) {
+        dsp_add(budget_end, 1, client);
+    }
+}
+
+/* Handles 'budget', which posts the load, the level and the latest switches, and 'budget PERCENT', which
+ sets the budget for every adaptive object in the process. */
+static void
+budget_message (budget_client_t* client, int argc, t_atom* argv) {
+    budget_t *budget;
+    int first;
+    int i;
+    
+    if (!client->budget) {
+        client->budget = budget_get();
+    }
+    budget = client->budget;
+    first = budget->numSwitches - BUDGET_LOG_SIZE;
+    if (argc > 0) {
+        t_float percent = atom_getfloat(argv);
+        budget->percent = (percent < 0.f ? 0.f : percent);
+        return;
+    }
+    post("%s: load %.1f%% of a %g%% budget, quality level %d of %d", BUDGET_NAME, budget->load,
+         budget->percent, budget->level, BUDGET_LEVEL_MAX);
+    for (i = (first > 0 ? first : 0); i < budget->numSwitches; i++) {
+        const budget_switch_t *entry = &budget->log[i % BUDGET_LOG_SIZE];
+        post("  %.1f s ago: level %d -> %d at %.1f%% load",
+             clock_gettimesincewithunits(entry->time, 1., 0) * 1e-3, entry->from, entry->to, entry->load);
+    }
+}
+
+/* Quality index or order of anti-aliasing for a level: one step lower for each level, down to 0. */
+static BUDGET_INLINE int
+budget_reduce_order (int order, int level) {
+    return (order > level ? order - level : 0);
+}
+
+/* Oversampling factor for a level: kept at the first level, then halved at each one, down to 1. */
+static BUDGET_INLINE int
+budget_reduce_factor (int factor, int level) {
+    int reduced = (level > 1 ? factor >> (level - 1) : factor);
+    return (reduced < 1 ? 1 : reduced);
+}
+
+#endif /* BUDGET_H */
@@ -0,0 +1,108 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Runtime CPU feature detection used to pick SIMD kernels when an external's class is set up.
+//  Kernels for an instruction set are only compiled when CPU_X86 or CPU_NEON is defined, and
+//  only called when cpu_features() reports support for it.
+//
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(_MSC_VER)
+# define CPU_INLINE __inline
+# define CPU_FORCE_INLINE __forceinline
+#else
+# define CPU_INLINE inline
+# define CPU_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+#define CPU_FEATURE_SSE2 (1 << 0)
+#define CPU_FEATURE_AVX2 (1 << 1)
+#define CPU_FEATURE_NEON (1 << 2)
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+# define CPU_X86 1
+# if defined(_MSC_VER)
+#  include <intrin.h>
+# endif
+# include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+# define CPU_NEON 1
+# include <arm_neon.h>
+#endif
+
+/* GCC and Clang only emit instructions beyond the baseline target inside functions that ask
+ for them, which lets a single binary carry kernels for several instruction sets. */
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+# define CPU_TARGET_SSE2 __attribute__((target("sse2")))
+# define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+# define CPU_TARGET_SSE2
+# define CPU_TARGET_AVX2
+#endif
+
+static CPU_INLINE int
+cpu_features_detect (void) {
+    int features = 0;
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 1) {
+        __cpuid(info, 1);
+        if (info[3] & (1 << 26)) {
+            features |= CPU_FEATURE_SSE2;
+        }
+        /* AVX state must also be enabled by the OS (OSXSAVE set and XCR0 saving XMM/YMM). */
+        if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5)) {
+                features |= CPU_FEATURE_AVX2;
+            }
+        }
+    }
+#elif defined(CPU_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        features |= CPU_FEATURE_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        features |= CPU_FEATURE_AVX2;
+    }
+#elif defined(CPU_NEON)
+    /* NEON is part of the baseline for every ARM target this is compiled with NEON enabled for. */
+    features |= CPU_FEATURE_NEON;
+#endif
+
+    return features;
+}
+
+/* Feature bits of the CPU we are running on. Detection happens once and is then cached. */
+static CPU_INLINE int
+cpu_features (void) {
+    static int features = -1;
+    if (features < 0) {
+        features = cpu_features_detect();
+    }
+    return features;
+}
+
+#endif /* CPU_FEATURES_H */
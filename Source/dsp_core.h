@@ -0,0 +1,99 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Compile-time specialization for the DSP cores (foldback.h, polyblep.h). C has no templates, so a
+//  core is written once, in a header without include guards, against the sample type DSP_T, and is
+//  included once per sample type with DSP_S set to its suffix: f for float, d for double. Vector
+//  kernels are included again per instruction set with DSP_VEC naming one of the backends in
+//  dsp_simd.h. Every function is static and inline, so each build carries only the instantiations
+//  it calls, and none of them depend on Pd.
+//
+
+#ifndef DSP_CORE_H
+#define DSP_CORE_H
+
+#include "cpu_features.h"
+#include <math.h>
+
+/* Token pasting that expands its arguments first. */
+#define DSP_CAT_(a, b) a##b
+#define DSP_CAT(a, b) DSP_CAT_(a, b)
+
+/* Sample types by suffix. */
+typedef float dsp_sample_f;
+typedef double dsp_sample_d;
+
+/* Inside a core: the sample type, and a function name with the sample type's suffix appended. */
+#define DSP_T DSP_CAT(dsp_sample_, DSP_S)
+#define DSP_FN(name) DSP_CAT(name##_, DSP_S)
+
+/* Inside a vector core: a function name with the backend appended (e.g. foldback_lanes_avx2_f), an
+ operation or property of the backend, its vector and mask types, width and target attribute. */
+#define DSP_VFN(name) DSP_CAT(name##_, DSP_VEC)
+#define DSP_V(op) DSP_CAT(simd_##op##_, DSP_VEC)
+#define DSP_VT DSP_V(vec)
+#define DSP_VMASK DSP_V(mask)
+#define DSP_VN DSP_V(width)
+#define DSP_VTARGET DSP_V(target)
+
+/* Math functions of the sample type. */
+static CPU_INLINE float
+dsp_fabs_f (float x) {
+    return fabsf(x);
+}
+
+static CPU_INLINE double
+dsp_fabs_d (double x) {
+    return fabs(x);
+}
+
+static CPU_INLINE float
+dsp_fmod_f (float x, float y) {
+    return fmodf(x, y);
+}
+
+static CPU_INLINE double
+dsp_fmod_d (double x, double y) {
+    return fmod(x, y);
+}
+
+static CPU_INLINE float
+dsp_floor_f (float x) {
+    return floorf(x);
+}
+
+static CPU_INLINE double
+dsp_floor_d (double x) {
+    return floor(x);
+}
+
+#define DSP_FABS DSP_FN(dsp_fabs)
+#define DSP_FMOD DSP_FN(dsp_fmod)
+#define DSP_FLOOR DSP_FN(dsp_floor)
+
+/* The instantiation for Pd's t_sample, which is what the externals call: name_f, or name_d when m_pd.h
+ was included with PD_FLOATSIZE 64 before this header. */
+#if defined(PD_FLOATSIZE) && PD_FLOATSIZE == 64
+# define DSP_PD(name) name##_d
+#else
+# define DSP_PD(name) name##_f
+#endif
+
+#endif /* DSP_CORE_H */
@@ -0,0 +1,382 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Vector backends for the DSP cores, one per instruction set and sample type: sse2_f, avx2_f and
+//  neon_f for float, sse2_d, avx2_d and (on 64-bit ARM) neon_d for double. Each gives the same set
+//  of operations under the names simd_<op>_<backend>, which a vector core reaches through DSP_V(op)
+//  with DSP_VEC set to the backend (see dsp_core.h). Most map straight onto an intrinsic; the rest
+//  are written out here so the cores need no per-backend code of their own.
+//
+//    vec, mask     vector type, and the type comparisons return
+//    width         samples per vector
+//    target        function attribute the backend's code must be compiled with
+//    load, store   unaligned
+//    set1, zero    all lanes set to one value, or to zero
+//    add, sub, mul, max, abs, floor
+//    gt            mask of the lanes where a > b
+//    select        lanes of a where the mask is set, of b elsewhere
+//    keep          lanes of v where the mask is set, zero elsewhere
+//    inv4          0.25 / v, the reciprocal of four times v
+//    hmax          largest lane
+//    end           called before returning to scalar code (clears the upper halves after AVX)
+//
+
+#ifndef DSP_SIMD_H
+#define DSP_SIMD_H
+
+#include "dsp_core.h"
+
+#if defined(CPU_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+# define SIMD_NEON_F64 1 /* ARMv7 NEON has no double precision lanes. */
+#endif
+
+#if defined(CPU_X86)
+
+/* ---- sse2_f ---- */
+
+typedef __m128 simd_vec_sse2_f;
+typedef __m128 simd_mask_sse2_f;
+
+#define simd_width_sse2_f 4
+#define simd_target_sse2_f CPU_TARGET_SSE2
+#define simd_load_sse2_f _mm_loadu_ps
+#define simd_store_sse2_f _mm_storeu_ps
+#define simd_set1_sse2_f _mm_set1_ps
+#define simd_zero_sse2_f _mm_setzero_ps
+#define simd_add_sse2_f _mm_add_ps
+#define simd_sub_sse2_f _mm_sub_ps
+#define simd_mul_sse2_f _mm_mul_ps
+#define simd_max_sse2_f _mm_max_ps
+#define simd_gt_sse2_f _mm_cmpgt_ps
+#define simd_keep_sse2_f _mm_and_ps
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128
+simd_abs_sse2_f (__m128 v) {
+    return _mm_and_ps(v, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+}
+
+/* SSE2 has no rounding instruction. Truncation rounds negative values up, so one is taken off where it
+ did; values of 2^23 and more are integers already and are passed through. */
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128
+simd_floor_sse2_f (__m128 v) {
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 big = _mm_set1_ps(8388608.f);
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    __m128 isBig = _mm_cmpge_ps(simd_abs_sse2_f(v), big);
+    t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), one));
+    return _mm_or_ps(_mm_and_ps(isBig, v), _mm_andnot_ps(isBig, t));
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128
+simd_select_sse2_f (__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128
+simd_inv4_sse2_f (__m128 v) {
+    return _mm_div_ps(_mm_set1_ps(0.25f), v);
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE float
+simd_hmax_sse2_f (__m128 v) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    lanes[0] = (lanes[1] > lanes[0] ? lanes[1] : lanes[0]);
+    lanes[2] = (lanes[3] > lanes[2] ? lanes[3] : lanes[2]);
+    return (lanes[2] > lanes[0] ? lanes[2] : lanes[0]);
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE void
+simd_end_sse2_f (void) {
+}
+
+/* ---- avx2_f ---- */
+
+typedef __m256 simd_vec_avx2_f;
+typedef __m256 simd_mask_avx2_f;
+
+#define simd_width_avx2_f 8
+#define simd_target_avx2_f CPU_TARGET_AVX2
+#define simd_load_avx2_f _mm256_loadu_ps
+#define simd_store_avx2_f _mm256_storeu_ps
+#define simd_set1_avx2_f _mm256_set1_ps
+#define simd_zero_avx2_f _mm256_setzero_ps
+#define simd_add_avx2_f _mm256_add_ps
+#define simd_sub_avx2_f _mm256_sub_ps
+#define simd_mul_avx2_f _mm256_mul_ps
+#define simd_max_avx2_f _mm256_max_ps
+#define simd_floor_avx2_f _mm256_floor_ps
+#define simd_keep_avx2_f _mm256_and_ps
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256
+simd_abs_avx2_f (__m256 v) {
+    return _mm256_and_ps(v, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256
+simd_gt_avx2_f (__m256 a, __m256 b) {
+    return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256
+simd_select_avx2_f (__m256 mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256
+simd_inv4_avx2_f (__m256 v) {
+    return _mm256_div_ps(_mm256_set1_ps(0.25f), v);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE float
+simd_hmax_avx2_f (__m256 v) {
+    return simd_hmax_sse2_f(_mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+/* The scalar code that follows is not VEX-encoded; clearing the upper halves first avoids the SSE/AVX
+ transition penalty. */
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE void
+simd_end_avx2_f (void) {
+    _mm256_zeroupper();
+}
+
+/* ---- sse2_d ---- */
+
+typedef __m128d simd_vec_sse2_d;
+typedef __m128d simd_mask_sse2_d;
+
+#define simd_width_sse2_d 2
+#define simd_target_sse2_d CPU_TARGET_SSE2
+#define simd_load_sse2_d _mm_loadu_pd
+#define simd_store_sse2_d _mm_storeu_pd
+#define simd_set1_sse2_d _mm_set1_pd
+#define simd_zero_sse2_d _mm_setzero_pd
+#define simd_add_sse2_d _mm_add_pd
+#define simd_sub_sse2_d _mm_sub_pd
+#define simd_mul_sse2_d _mm_mul_pd
+#define simd_max_sse2_d _mm_max_pd
+#define simd_gt_sse2_d _mm_cmpgt_pd
+#define simd_keep_sse2_d _mm_and_pd
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128d
+simd_abs_sse2_d (__m128d v) {
+    return _mm_andnot_pd(_mm_set1_pd(-0.), v);
+}
+
+/* There is no conversion to and from 64-bit integers either, so the magnitude is rounded to an integer by
+ adding and taking away 2^52, where the spacing of doubles is 1. With the sign put back, one is taken off
+ where that rounded up. Values of 2^52 and more are integers already and are passed through. */
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128d
+simd_floor_sse2_d (__m128d v) {
+    const __m128d signMask = _mm_set1_pd(-0.);
+    const __m128d big = _mm_set1_pd(4503599627370496.);
+    __m128d magnitude = _mm_andnot_pd(signMask, v);
+    __m128d t = _mm_sub_pd(_mm_add_pd(magnitude, big), big);
+    __m128d isBig = _mm_cmpge_pd(magnitude, big);
+    t = _mm_or_pd(t, _mm_and_pd(signMask, v));
+    t = _mm_sub_pd(t, _mm_and_pd(_mm_cmpgt_pd(t, v), _mm_set1_pd(1.)));
+    return _mm_or_pd(_mm_and_pd(isBig, v), _mm_andnot_pd(isBig, t));
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128d
+simd_select_sse2_d (__m128d mask, __m128d a, __m128d b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE __m128d
+simd_inv4_sse2_d (__m128d v) {
+    return _mm_div_pd(_mm_set1_pd(0.25), v);
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE double
+simd_hmax_sse2_d (__m128d v) {
+    double lanes[2];
+    _mm_storeu_pd(lanes, v);
+    return (lanes[1] > lanes[0] ? lanes[1] : lanes[0]);
+}
+
+CPU_TARGET_SSE2 static CPU_FORCE_INLINE void
+simd_end_sse2_d (void) {
+}
+
+/* ---- avx2_d ---- */
+
+typedef __m256d simd_vec_avx2_d;
+typedef __m256d simd_mask_avx2_d;
+
+#define simd_width_avx2_d 4
+#define simd_target_avx2_d CPU_TARGET_AVX2
+#define simd_load_avx2_d _mm256_loadu_pd
+#define simd_store_avx2_d _mm256_storeu_pd
+#define simd_set1_avx2_d _mm256_set1_pd
+#define simd_zero_avx2_d _mm256_setzero_pd
+#define simd_add_avx2_d _mm256_add_pd
+#define simd_sub_avx2_d _mm256_sub_pd
+#define simd_mul_avx2_d _mm256_mul_pd
+#define simd_max_avx2_d _mm256_max_pd
+#define simd_floor_avx2_d _mm256_floor_pd
+#define simd_keep_avx2_d _mm256_and_pd
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256d
+simd_abs_avx2_d (__m256d v) {
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.), v);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256d
+simd_gt_avx2_d (__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256d
+simd_select_avx2_d (__m256d mask, __m256d a, __m256d b) {
+    return _mm256_blendv_pd(b, a, mask);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE __m256d
+simd_inv4_avx2_d (__m256d v) {
+    return _mm256_div_pd(_mm256_set1_pd(0.25), v);
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE double
+simd_hmax_avx2_d (__m256d v) {
+    return simd_hmax_sse2_d(_mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+}
+
+CPU_TARGET_AVX2 static CPU_FORCE_INLINE void
+simd_end_avx2_d (void) {
+    _mm256_zeroupper();
+}
+
+#endif /* CPU_X86 */
+
+#if defined(CPU_NEON)
+
+/* ---- neon_f ---- */
+
+typedef float32x4_t simd_vec_neon_f;
+typedef uint32x4_t simd_mask_neon_f;
+
+#define simd_width_neon_f 4
+#define simd_target_neon_f
+#define simd_load_neon_f vld1q_f32
+#define simd_store_neon_f vst1q_f32
+#define simd_set1_neon_f vdupq_n_f32
+#define simd_add_neon_f vaddq_f32
+#define simd_sub_neon_f vsubq_f32
+#define simd_mul_neon_f vmulq_f32
+#define simd_max_neon_f vmaxq_f32
+#define simd_abs_neon_f vabsq_f32
+#define simd_gt_neon_f vcgtq_f32
+#define simd_select_neon_f vbslq_f32
+
+static CPU_FORCE_INLINE float32x4_t
+simd_zero_neon_f (void) {
+    return vdupq_n_f32(0.f);
+}
+
+static CPU_FORCE_INLINE float32x4_t
+simd_floor_neon_f (float32x4_t v) {
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return vrndmq_f32(v);
+#else
+    /* ARMv7 has no rounding instruction; see simd_floor_sse2_f. */
+    float32x4_t t = vcvtq_f32_s32(vcvtq_s32_f32(v));
+    uint32x4_t isBig = vcgeq_f32(vabsq_f32(v), vdupq_n_f32(8388608.f));
+    t = vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(t, v), vreinterpretq_u32_f32(vdupq_n_f32(1.f)))));
+    return vbslq_f32(isBig, v, t);
+#endif
+}
+
+static CPU_FORCE_INLINE float32x4_t
+simd_keep_neon_f (uint32x4_t mask, float32x4_t v) {
+    return vreinterpretq_f32_u32(vandq_u32(mask, vreinterpretq_u32_f32(v)));
+}
+
+/* ARMv7 has no vector divide. The reciprocal estimate refined by two Newton steps is within an ulp or two
+ of one. */
+static CPU_FORCE_INLINE float32x4_t
+simd_inv4_neon_f (float32x4_t v) {
+    float32x4_t fourV = vmulq_n_f32(v, 4.f);
+    float32x4_t inverse = vrecpeq_f32(fourV);
+    inverse = vmulq_f32(inverse, vrecpsq_f32(fourV, inverse));
+    return vmulq_f32(inverse, vrecpsq_f32(fourV, inverse));
+}
+
+static CPU_FORCE_INLINE float
+simd_hmax_neon_f (float32x4_t v) {
+    float32x2_t half = vpmax_f32(vget_low_f32(v), vget_high_f32(v));
+    half = vpmax_f32(half, half);
+    return vget_lane_f32(half, 0);
+}
+
+static CPU_FORCE_INLINE void
+simd_end_neon_f (void) {
+}
+
+#endif /* CPU_NEON */
+
+#if defined(SIMD_NEON_F64)
+
+/* ---- neon_d ---- */
+
+typedef float64x2_t simd_vec_neon_d;
+typedef uint64x2_t simd_mask_neon_d;
+
+#define simd_width_neon_d 2
+#define simd_target_neon_d
+#define simd_load_neon_d vld1q_f64
+#define simd_store_neon_d vst1q_f64
+#define simd_set1_neon_d vdupq_n_f64
+#define simd_add_neon_d vaddq_f64
+#define simd_sub_neon_d vsubq_f64
+#define simd_mul_neon_d vmulq_f64
+#define simd_max_neon_d vmaxq_f64
+#define simd_abs_neon_d vabsq_f64
+#define simd_floor_neon_d vrndmq_f64
+#define simd_gt_neon_d vcgtq_f64
+#define simd_select_neon_d vbslq_f64
+
+static CPU_FORCE_INLINE float64x2_t
+simd_zero_neon_d (void) {
+    return vdupq_n_f64(0.);
+}
+
+static CPU_FORCE_INLINE float64x2_t
+simd_keep_neon_d (uint64x2_t mask, float64x2_t v) {
+    return vreinterpretq_f64_u64(vandq_u64(mask, vreinterpretq_u64_f64(v)));
+}
+
+static CPU_FORCE_INLINE float64x2_t
+simd_inv4_neon_d (float64x2_t v) {
+    return vdivq_f64(vdupq_n_f64(0.25), v);
+}
+
+static CPU_FORCE_INLINE double
+simd_hmax_neon_d (float64x2_t v) {
+    return vmaxvq_f64(v);
+}
+
+static CPU_FORCE_INLINE void
+simd_end_neon_d (void) {
+}
+
+#endif /* SIMD_NEON_F64 */
+
+#endif /* DSP_SIMD_H */
@@ -0,0 +1,149 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Timestamped parameter changes for sample-accurate control of an external's DSP.
+//  A message handler pushes the new value with the logical time it arrived at, and the
+//  perform routine applies it at the matching sample of its next block.
+//
+//  Pd runs the DSP tick for a block at the logical time its messages lead up to, so a
+//  message that arrived k samples before the tick lands k samples before the end of the
+//  block. Every change is then one block late, but they keep their spacing exactly.
+//
+//  Under block~ or switch~ the object's block need not be Pd's. Time is counted in the
+//  object's own samples, whose rate takes in overlap and upsampling. A larger block is
+//  computed once every few ticks and spans all of them; a smaller one is computed several
+//  times in a tick, all at the same logical time, and the tick's span is divided among
+//  them in order.
+//
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include "m_pd.h"
+
+#if defined(_MSC_VER)
+# define EVENT_QUEUE_INLINE __inline
+#else
+# define EVENT_QUEUE_INLINE inline
+#endif
+
+#define EVENT_QUEUE_SIZE (32) /* Changes one queue holds between two blocks. */
+
+struct _event {
+    double time; /* Logical time the change arrived at. */
+    t_float value;
+};
+
+typedef struct _event event_t;
+
+/* Fixed-size ring of pending changes, oldest first. It is part of the object, so pushing never allocates. */
+struct _event_queue {
+    event_t events[EVENT_QUEUE_SIZE];
+    int head;
+    int count;
+    double rate; /* The object's sample rate over Pd's. */
+    int blocksPerTick; /* Blocks the object computes in one of Pd's. */
+    int block; /* Which of them is being computed. */
+    double blockTime; /* Logical time of the last block. */
+};
+
+typedef struct _event_queue event_queue_t;
+
+static EVENT_QUEUE_INLINE void
+event_queue_init (event_queue_t* queue) {
+    queue->head = 0;
+    queue->count = 0;
+    queue->rate = 1.;
+    queue->blocksPerTick = 1;
+    queue->block = 0;
+    queue->blockTime = -1.;
+}
+
+/* Keeps count of the blocks computed within a tick. */
+static t_int*
+event_queue_perform (t_int* args) {
+    event_queue_t *queue = (event_queue_t *)args[1];
+    double now = clock_getlogicaltime();
+    queue->block = (now == queue->blockTime && queue->block < queue->blocksPerTick - 1 ? queue->block + 1 : 0);
+    queue->blockTime = now;
+    return (args + 2);
+}
+
+/* To be called from the dsp method with the object's block size and sample rate, before its own perform
+ routine is added. The queue must stay where it is until the next call. */
+static EVENT_QUEUE_INLINE void
+event_queue_dsp (event_queue_t* queue, int numSamples, t_float sampleRate) {
+    double blocks = sys_getblksize() * (double)sampleRate / ((double)sys_getsr() * numSamples);
+    queue->rate = sampleRate / sys_getsr();
+    queue->blocksPerTick = (blocks > 1. ? (int)(blocks + 0.5) : 1);
+    queue->block = 0;
+    queue->blockTime = -1.;
+    if (queue->blocksPerTick > 1) {
+        dsp_add(event_queue_perform, 1, queue);
+    }
+}
+
+/* Queues a change at the current logical time. When the queue is full the oldest change is taken out to
+ make room and returned through 'dropped' (with a return value of 1); the caller applies it right away,
+ since every change still queued supersedes it. */
+static EVENT_QUEUE_INLINE int
+event_queue_push (event_queue_t* queue, t_float value, t_float* dropped) {
+    int full = (queue->count == EVENT_QUEUE_SIZE);
+    event_t *event;
+
+    if (full) {
+        *dropped = queue->events[queue->head].value;
+        queue->head = (queue->head + 1) % EVENT_QUEUE_SIZE;
+        queue->count--;
+    }
+    event = &queue->events[(queue->head + queue->count) % EVENT_QUEUE_SIZE];
+    event->time = clock_getlogicaltime();
+    event->value = value;
+    queue->count++;
+    return full;
+}
+
+/* Sample of the current block the oldest change applies at, or numSamples if there is none or it belongs to
+ a later block of the tick. Changes older than the block (queued while DSP was starting) apply at its first
+ sample. */
+static EVENT_QUEUE_INLINE int
+event_queue_next (const event_queue_t* queue, int numSamples) {
+    int last = (queue->block == queue->blocksPerTick - 1);
+    double offset;
+    if (queue->count == 0) {
+        return numSamples;
+    }
+    offset = (double)numSamples * (queue->blocksPerTick - queue->block)
+           - clock_gettimesincewithunits(queue->events[queue->head].time, 1., 1) * queue->rate;
+    if (offset >= numSamples) {
+        return (last ? numSamples - 1 : numSamples);
+    }
+    return (offset <= 0. ? 0 : (int)offset);
+}
+
+static EVENT_QUEUE_INLINE t_float
+event_queue_pop (event_queue_t* queue) {
+    t_float value = queue->events[queue->head].value;
+    queue->head = (queue->head + 1) % EVENT_QUEUE_SIZE;
+    queue->count--;
+    return value;
+}
+
+#endif /* EVENT_QUEUE_H */
@@ -0,0 +1,180 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Foldback core shared by foldback~ and blepfold~, with no dependency on Pd. The kernels are
+//  specialized at compile time for float and double (foldback_process_f, foldback_process_d) and,
+//  for each, for the vector backends of dsp_simd.h (foldback_process_avx2_f, ...); the externals
+//  call the instantiation for t_sample through DSP_PD. Object state, fast paths and dispatch stay
+//  with each external.
+//
+
+#ifndef FOLDBACK_H
+#define FOLDBACK_H
+
+#include "dsp_core.h"
+#include "dsp_simd.h"
+#include <math.h>
+#include <string.h>
+
+#define FOLDBACK_ADAA_EPSILON (1e-5) /* Relative to the threshold; closer inputs are ill-conditioned for ADAA. */
+#define FOLDBACK_STAGES_MAX (8)
+
+/* History for antiderivative anti-aliasing. Antiderivative values are cached for the threshold they were
+ computed with and recomputed when it changes. */
+struct _foldback_adaa {
+    double x1, x2; /* Previous two input samples. */
+    double f1; /* First antiderivative at x1. */
+    double f2; /* Second antiderivative at x1. */
+    double d1; /* Divided difference of the second antiderivative between x2 and x1. */
+    double threshold; /* Threshold the cached values are for, or 0 if there are none. */
+    double inversePeriod; /* 1 / (4 * threshold). */
+};
+
+typedef struct _foldback_adaa foldback_adaa_t;
+
+/* Antiderivative anti-aliasing. The fold is a triangle wave of period 4 * threshold; with
+
+     d = ((x + th) mod 4th) - 2th,  fold(x) = th - |d|
+
+ its antiderivatives are periodic too, since each has zero mean over a period:
+
+     F1(x) = th * d - d * |d| / 2,  F2(x) = th * d^2 / 2 - |d|^3 / 6
+
+ First order outputs (F1(x[n]) - F1(x[n-1])) / (x[n] - x[n-1]), the average of the fold over the line
+ between two samples; second order does the same with F2 over three samples. Where the samples are too
+ close for the divided differences to be accurate, the fold at the midpoint is used instead. Everything is
+ computed in double whatever the sample type, as the differences cancel most of the significant digits. */
+static CPU_INLINE double
+foldback_adaa_offset (const foldback_adaa_t* state, double x) {
+    double u = x + state->threshold;
+    return u - 4. * state->threshold * floor(u * state->inversePeriod) - 2. * state->threshold;
+}
+
+static CPU_INLINE double
+foldback_adaa_f0 (const foldback_adaa_t* state, double x) {
+    return state->threshold - fabs(foldback_adaa_offset(state, x));
+}
+
+static CPU_INLINE double
+foldback_adaa_f1 (const foldback_adaa_t* state, double x) {
+    double d = foldback_adaa_offset(state, x);
+    return state->threshold * d - d * fabs(d) * 0.5;
+}
+
+static CPU_INLINE double
+foldback_adaa_f2 (const foldback_adaa_t* state, double x) {
+    double d = foldback_adaa_offset(state, x);
+    return (state->threshold * 0.5 - fabs(d) * (1. / 6.)) * d * d;
+}
+
+/* Divided difference of F2 between b and a, with a's F2 already computed. */
+static CPU_INLINE double
+foldback_adaa_d1 (const foldback_adaa_t* state, double a, double f2a, double b) {
+    return (fabs(a - b) > FOLDBACK_ADAA_EPSILON * state->threshold ? (f2a - foldback_adaa_f2(state, b)) / (a - b) :
+            foldback_adaa_f1(state, (a + b) * 0.5));
+}
+
+/* Points the cached values at a new threshold. */
+static CPU_INLINE void
+foldback_adaa_retune (foldback_adaa_t* state, double threshold) {
+    state->threshold = threshold;
+    state->inversePeriod = 0.25 / threshold;
+    state->f1 = foldback_adaa_f1(state, state->x1);
+    state->f2 = foldback_adaa_f2(state, state->x1);
+    state->d1 = foldback_adaa_d1(state, state->x1, state->f2, state->x2);
+}
+
+/* The vectorized kernels fold with a triangle wave of period 4 * threshold instead of fmod:
+
+     m = (x - th) - 4th * floor((x - th) / 4th),  y = |m - 2th| - th
+
+ m is in [0, 4th) where fmod's result is in (-4th, 4th), but the triangle is symmetric about 2th, so both
+ give the same fold. Samples within the threshold are selected through unchanged with a mask, so the loop
+ has no branches and those samples match the reference exactly. Folded samples differ from it by the
+ rounding of the floor step, a few ulps of the input. A threshold of zero or less gives silence.
+
+ Between stages of the series fold, the fold is computed on its own, without passing samples within the
+ threshold through unchanged (the floor form gives them back to within rounding) and without the check for
+ a threshold of zero or less, which is applied once after the last stage:
+
+     d = gain * x + bias - th,  y = |d - 2th - 4th * floor(d / 4th)| - th
+
+ Each stage depends on the one before, so two vectors (x and y, with thresholds th[0] and th[1]) go
+ through the stages side by side to give the CPU independent work.
+
+ The stage kernels are compiled with the stage count fixed for the common counts of 2 to 6, and once more
+ taking it at run time for the others (foldback_stages_any). The shared body is force-inlined into each. Its
+ stages are written out in FOLDBACK_STAGES_UNROLLED as a switch that is entered at the stage count and falls
+ through the rest, so with a constant count it is straight-line code with every gain and bias in a
+ register. */
+#define FOLDBACK_STAGES_UNROLLED(stage, x, y, numStages) \
+    switch (numStages) { \
+        case 8: x = stage(x, numStages - 8, 0); y = stage(y, numStages - 8, 1); /* fall through */ \
+        case 7: x = stage(x, numStages - 7, 0); y = stage(y, numStages - 7, 1); /* fall through */ \
+        case 6: x = stage(x, numStages - 6, 0); y = stage(y, numStages - 6, 1); /* fall through */ \
+        case 5: x = stage(x, numStages - 5, 0); y = stage(y, numStages - 5, 1); /* fall through */ \
+        case 4: x = stage(x, numStages - 4, 0); y = stage(y, numStages - 4, 1); /* fall through */ \
+        case 3: x = stage(x, numStages - 3, 0); y = stage(y, numStages - 3, 1); /* fall through */ \
+        case 2: x = stage(x, numStages - 2, 0); y = stage(y, numStages - 2, 1); /* fall through */ \
+        default: x = stage(x, numStages - 1, 0); y = stage(y, numStages - 1, 1); \
+    }
+
+#define FOLDBACK_STAGES_SPECIALIZE(suffix, count) \
+    DSP_VTARGET static CPU_INLINE void \
+    DSP_VFN(foldback_stages##suffix) (const DSP_T* in, DSP_T* out, int numSamples, const DSP_T* thresholds, \
+                                      int step, const DSP_T* gains, const DSP_T* biases, int numStages) { \
+        DSP_VFN(foldback_stages)(in, out, numSamples, thresholds, step, gains, biases, count); \
+    }
+
+/* Single precision. */
+#define DSP_S f
+#include "foldback_core.h"
+#if defined(CPU_X86)
+# define DSP_VEC sse2_f
+# include "foldback_core_simd.h"
+# undef DSP_VEC
+# define DSP_VEC avx2_f
+# include "foldback_core_simd.h"
+# undef DSP_VEC
+#elif defined(CPU_NEON)
+# define DSP_VEC neon_f
+# include "foldback_core_simd.h"
+# undef DSP_VEC
+#endif
+#undef DSP_S
+
+/* Double precision. */
+#define DSP_S d
+#include "foldback_core.h"
+#if defined(CPU_X86)
+# define DSP_VEC sse2_d
+# include "foldback_core_simd.h"
+# undef DSP_VEC
+# define DSP_VEC avx2_d
+# include "foldback_core_simd.h"
+# undef DSP_VEC
+#elif defined(SIMD_NEON_F64)
+# define DSP_VEC neon_d
+# include "foldback_core_simd.h"
+# undef DSP_VEC
+#endif
+#undef DSP_S
+
+#endif /* FOLDBACK_H */
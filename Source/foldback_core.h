@@ -0,0 +1,192 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Foldback core, included by foldback.h once per sample type (see dsp_core.h): the reference fold of
+//  one sample, and the scalar kernels for a block with a constant or per-sample threshold, for stages
+//  in series, for the peak, and with antiderivative anti-aliasing.
+//
+//  No include guard: this is meant to be included more than once.
+//
+
+/* Folds one sample back into [-threshold, threshold], for a threshold above zero. Samples within it pass
+ through unchanged. */
+static CPU_INLINE DSP_T
+DSP_FN(foldback_sample) (DSP_T sample, DSP_T threshold) {
+    if ((sample > threshold) || (sample < -threshold)) {
+        return DSP_FABS(DSP_FABS(DSP_FMOD(sample - threshold, threshold * 4)) - threshold * 2) - threshold;
+    }
+    return sample;
+}
+
+/* Folds a block with the original per-sample algorithm. This is the scalar fallback and the reference the
+ vectorized kernels are checked against. A threshold of zero or less leaves no room to fold into, so the
+ output is silence (fmod would return NaN). */
+static CPU_INLINE void
+DSP_FN(foldback_process) (const DSP_T* in, DSP_T* out, int numSamples, DSP_T threshold) {
+    if (threshold <= 0) {
+        memset(out, 0, numSamples * sizeof(DSP_T));
+        return;
+    }
+    
+    while (numSamples--) {
+        *out++ = DSP_FN(foldback_sample)(*in++, threshold);
+    }
+}
+
+/* Same as foldback_process with a threshold per sample. */
+static CPU_INLINE void
+DSP_FN(foldback_process_varying) (const DSP_T* in, DSP_T* out, int numSamples, const DSP_T* thresholds) {
+    while (numSamples--) {
+        DSP_T sample = *in++;
+        DSP_T threshold = *thresholds++;
+        *out++ = (threshold <= 0 ? 0 : DSP_FN(foldback_sample)(sample, threshold));
+    }
+}
+
+/* Series folding: each stage computes x = fold(gain * x + bias) on the output of the one before, and all of
+ them run on a sample before the next is loaded, so any number of stages is a single pass over the block.
+ As for the ADAA kernels, the threshold of sample i is thresholds[i * step]. */
+static CPU_INLINE DSP_T
+DSP_FN(foldback_stage_sample) (DSP_T sample, DSP_T threshold) {
+    return (threshold <= 0 ? 0 : DSP_FN(foldback_sample)(sample, threshold));
+}
+
+static CPU_INLINE void
+DSP_FN(foldback_stages_process) (const DSP_T* in, DSP_T* out, int numSamples, const DSP_T* thresholds, int step,
+                                 const DSP_T* gains, const DSP_T* biases, int numStages) {
+    int i, k;
+    for (i = 0; i < numSamples; i++) {
+        DSP_T sample = in[i];
+        DSP_T threshold = thresholds[i * step];
+        for (k = 0; k < numStages; k++) {
+            sample = DSP_FN(foldback_stage_sample)(sample * gains[k] + biases[k], threshold);
+        }
+        out[i] = sample;
+    }
+}
+
+/* Largest distance of a sample from 'center' in a block, or the first one over 'limit': past that the caller
+ has its answer, so the scan stops there. With a center of 0 this is the peak; with the first sample as the
+ center and a limit of 0 it tells whether the block is constant. */
+static CPU_INLINE DSP_T
+DSP_FN(foldback_peak_process) (const DSP_T* in, int numSamples, DSP_T center, DSP_T limit) {
+    DSP_T peak = 0;
+    while (numSamples--) {
+        DSP_T distance = DSP_FABS(*in++ - center);
+        if (!(distance <= limit)) {
+            return distance;
+        }
+        peak = (distance > peak ? distance : peak);
+    }
+    return peak;
+}
+
+/* First order antiderivative anti-aliasing (see foldback.h). The threshold of sample i is
+ thresholds[i * step], so a constant threshold is passed with a step of 0. */
+static CPU_INLINE void
+DSP_FN(foldback_adaa1_process) (foldback_adaa_t* state, const DSP_T* in, DSP_T* out, int numSamples,
+                                const DSP_T* thresholds, int step) {
+    int i;
+    for (i = 0; i < numSamples; i++) {
+        double x = in[i];
+        double threshold = thresholds[i * step];
+        double f1, dx;
+        
+        if (threshold <= 0.) {
+            state->threshold = 0.;
+            state->x2 = state->x1;
+            state->x1 = x;
+            out[i] = 0;
+            continue;
+        }
+        if (threshold != state->threshold) {
+            foldback_adaa_retune(state, threshold);
+        }
+        
+        f1 = foldback_adaa_f1(state, x);
+        dx = x - state->x1;
+        out[i] = (DSP_T)(fabs(dx) > FOLDBACK_ADAA_EPSILON * threshold ? (f1 - state->f1) / dx :
+                         foldback_adaa_f0(state, (x + state->x1) * 0.5));
+        state->x2 = state->x1;
+        state->x1 = x;
+        state->f1 = f1;
+    }
+    /* Second order picks up from x1 and x2 alone. */
+    state->threshold = 0.;
+}
+
+/* Second order antiderivative anti-aliasing. */
+static CPU_INLINE void
+DSP_FN(foldback_adaa2_process) (foldback_adaa_t* state, const DSP_T* in, DSP_T* out, int numSamples,
+                                const DSP_T* thresholds, int step) {
+    int i;
+    for (i = 0; i < numSamples; i++) {
+        double x = in[i];
+        double threshold = thresholds[i * step];
+        double f2, d1, y;
+        
+        if (threshold <= 0.) {
+            state->threshold = 0.;
+            state->x2 = state->x1;
+            state->x1 = x;
+            out[i] = 0;
+            continue;
+        }
+        if (threshold != state->threshold) {
+            foldback_adaa_retune(state, threshold);
+        }
+        
+        f2 = foldback_adaa_f2(state, x);
+        d1 = foldback_adaa_d1(state, x, f2, state->x1);
+        if (fabs(x - state->x2) > FOLDBACK_ADAA_EPSILON * threshold) {
+            y = 2. * (d1 - state->d1) / (x - state->x2);
+        } else {
+            /* The outer samples coincide: average over the line from their midpoint to x1 and back. */
+            double mid = (x + state->x2) * 0.5;
+            double delta = mid - state->x1;
+            if (fabs(delta) > FOLDBACK_ADAA_EPSILON * threshold) {
+                y = 2. / delta * (foldback_adaa_f1(state, mid) + (state->f2 - foldback_adaa_f2(state, mid)) / delta);
+            } else {
+                y = foldback_adaa_f0(state, (mid + state->x1) * 0.5);
+            }
+        }
+        out[i] = (DSP_T)y;
+        state->x2 = state->x1;
+        state->x1 = x;
+        state->f2 = f2;
+        state->d1 = d1;
+    }
+    /* First order needs f1, which is not kept up to date here. */
+    state->threshold = 0.;
+}
+
+/* Keeps the input history while ADAA is off, so turning it on later does not start from a jump. This has to
+ be read before folding, as the output may be the same buffer as the input. */
+static CPU_INLINE void
+DSP_FN(foldback_adaa_skip) (foldback_adaa_t* state, const DSP_T* in, int numSamples) {
+    if (numSamples >= 2) {
+        state->x2 = in[numSamples - 2];
+        state->x1 = in[numSamples - 1];
+    } else if (numSamples == 1) {
+        state->x2 = state->x1;
+        state->x1 = in[0];
+    }
+    state->threshold = 0.;
+}
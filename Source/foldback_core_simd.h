@@ -0,0 +1,137 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Vectorized foldback core, included by foldback.h once per backend of dsp_simd.h, after the scalar
+//  core of the same sample type, which takes the samples left over at the end of a block.
+//
+//  No include guard: this is meant to be included more than once.
+//
+
+/* A vector of folded samples, with th the threshold and inv4th the reciprocal of four times it. */
+DSP_VTARGET static CPU_INLINE DSP_VT
+DSP_VFN(foldback_lanes) (DSP_VT x, DSP_VT th, DSP_VT inv4th) {
+    DSP_VT fourTh = DSP_V(mul)(th, DSP_V(set1)(4));
+    DSP_VT d = DSP_V(sub)(x, th);
+    DSP_VT m = DSP_V(sub)(d, DSP_V(mul)(fourTh, DSP_V(floor)(DSP_V(mul)(d, inv4th))));
+    DSP_VT y = DSP_V(sub)(DSP_V(abs)(DSP_V(sub)(m, DSP_V(add)(th, th))), th);
+    DSP_VMASK outside = DSP_V(gt)(DSP_V(abs)(x), th);
+    DSP_VMASK positive = DSP_V(gt)(th, DSP_V(zero)());
+    return DSP_V(keep)(positive, DSP_V(select)(outside, y, x));
+}
+
+DSP_VTARGET static CPU_INLINE void
+DSP_VFN(foldback_process) (const DSP_T* in, DSP_T* out, int numSamples, DSP_T threshold) {
+    const DSP_VT th = DSP_V(set1)(threshold);
+    const DSP_VT inv4th = DSP_V(set1)(threshold > 0 ? (DSP_T)0.25 / threshold : 0);
+    
+    for (; numSamples >= DSP_VN; numSamples -= DSP_VN, in += DSP_VN, out += DSP_VN) {
+        DSP_V(store)(out, DSP_VFN(foldback_lanes)(DSP_V(load)(in), th, inv4th));
+    }
+    DSP_V(end)();
+    DSP_FN(foldback_process)(in, out, numSamples, threshold);
+}
+
+DSP_VTARGET static CPU_INLINE void
+DSP_VFN(foldback_process_varying) (const DSP_T* in, DSP_T* out, int numSamples, const DSP_T* thresholds) {
+    for (; numSamples >= DSP_VN; numSamples -= DSP_VN, in += DSP_VN, out += DSP_VN, thresholds += DSP_VN) {
+        DSP_VT th = DSP_V(load)(thresholds);
+        DSP_V(store)(out, DSP_VFN(foldback_lanes)(DSP_V(load)(in), th, DSP_V(inv4)(th)));
+    }
+    DSP_V(end)();
+    DSP_FN(foldback_process_varying)(in, out, numSamples, thresholds);
+}
+
+/* One stage of the series fold (see foldback.h). */
+DSP_VTARGET static CPU_INLINE DSP_VT
+DSP_VFN(foldback_stage) (DSP_VT x, DSP_VT gain, DSP_VT bias, DSP_VT th, DSP_VT inv4th) {
+    DSP_VT d = DSP_V(add)(DSP_V(mul)(x, gain), DSP_V(sub)(bias, th));
+    DSP_VT q = DSP_V(floor)(DSP_V(mul)(d, inv4th));
+    DSP_VT e = DSP_V(sub)(DSP_V(sub)(d, DSP_V(add)(th, th)), DSP_V(mul)(DSP_V(mul)(th, DSP_V(set1)(4)), q));
+    return DSP_V(sub)(DSP_V(abs)(e), th);
+}
+
+DSP_VTARGET static CPU_FORCE_INLINE void
+DSP_VFN(foldback_stages) (const DSP_T* in, DSP_T* out, int numSamples, const DSP_T* thresholds, int step,
+                          const DSP_T* gains, const DSP_T* biases, int numStages) {
+    DSP_VT gain[FOLDBACK_STAGES_MAX], bias[FOLDBACK_STAGES_MAX];
+    DSP_VT th[2], inv4th[2];
+    int k;
+    
+    for (k = 0; k < numStages; k++) {
+        gain[k] = DSP_V(set1)(gains[k]);
+        bias[k] = DSP_V(set1)(biases[k]);
+    }
+    th[0] = th[1] = DSP_V(set1)(thresholds[0]);
+    inv4th[0] = inv4th[1] = DSP_V(set1)(thresholds[0] > 0 ? (DSP_T)0.25 / thresholds[0] : 0);
+    
+#define FOLDBACK_STAGE_LANES(x, k, v) DSP_VFN(foldback_stage)(x, gain[k], bias[k], th[v], inv4th[v])
+    for (; numSamples >= 2 * DSP_VN;
+         numSamples -= 2 * DSP_VN, in += 2 * DSP_VN, out += 2 * DSP_VN, thresholds += 2 * DSP_VN * step) {
+        DSP_VT x = DSP_V(load)(in);
+        DSP_VT y = DSP_V(load)(in + DSP_VN);
+        if (step) {
+            th[0] = DSP_V(load)(thresholds);
+            th[1] = DSP_V(load)(thresholds + DSP_VN);
+            inv4th[0] = DSP_V(inv4)(th[0]);
+            inv4th[1] = DSP_V(inv4)(th[1]);
+        }
+        FOLDBACK_STAGES_UNROLLED(FOLDBACK_STAGE_LANES, x, y, numStages)
+        DSP_V(store)(out, DSP_V(keep)(DSP_V(gt)(th[0], DSP_V(zero)()), x));
+        DSP_V(store)(out + DSP_VN, DSP_V(keep)(DSP_V(gt)(th[1], DSP_V(zero)()), y));
+    }
+#undef FOLDBACK_STAGE_LANES
+    DSP_V(end)();
+    DSP_FN(foldback_stages_process)(in, out, numSamples, thresholds, step, gains, biases, numStages);
+}
+
+FOLDBACK_STAGES_SPECIALIZE(2, 2)
+FOLDBACK_STAGES_SPECIALIZE(3, 3)
+FOLDBACK_STAGES_SPECIALIZE(4, 4)
+FOLDBACK_STAGES_SPECIALIZE(5, 5)
+FOLDBACK_STAGES_SPECIALIZE(6, 6)
+FOLDBACK_STAGES_SPECIALIZE(_any, numStages)
+
+/* The limit is checked every four vectors, which keeps the horizontal maximum out of most iterations. */
+DSP_VTARGET static CPU_INLINE DSP_T
+DSP_VFN(foldback_peak) (const DSP_T* in, int numSamples, DSP_T center, DSP_T limit) {
+    const DSP_VT c = DSP_V(set1)(center);
+    DSP_VT peak = DSP_V(zero)();
+    DSP_T lanes, tail;
+    
+#define FOLDBACK_PEAK_LANES(k) DSP_V(abs)(DSP_V(sub)(DSP_V(load)(in + (k) * DSP_VN), c))
+    for (; numSamples >= 4 * DSP_VN; numSamples -= 4 * DSP_VN, in += 4 * DSP_VN) {
+        DSP_VT a = DSP_V(max)(FOLDBACK_PEAK_LANES(0), FOLDBACK_PEAK_LANES(1));
+        DSP_VT b = DSP_V(max)(FOLDBACK_PEAK_LANES(2), FOLDBACK_PEAK_LANES(3));
+        peak = DSP_V(max)(peak, DSP_V(max)(a, b));
+        lanes = DSP_V(hmax)(peak);
+        if (!(lanes <= limit)) {
+            DSP_V(end)();
+            return lanes;
+        }
+    }
+    for (; numSamples >= DSP_VN; numSamples -= DSP_VN, in += DSP_VN) {
+        peak = DSP_V(max)(peak, FOLDBACK_PEAK_LANES(0));
+    }
+#undef FOLDBACK_PEAK_LANES
+    lanes = DSP_V(hmax)(peak);
+    DSP_V(end)();
+    tail = DSP_FN(foldback_peak_process)(in, numSamples, center, limit);
+    return (tail > lanes ? tail : lanes);
+}
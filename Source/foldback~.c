@@ -37,32 +37,316 @@
 //
 
 #include "m_pd.h" /* Pure Data API */
+#include "budget.h"
+#include "cpu_features.h"
+#include "event_queue.h"
+#include "foldback.h"
+#include "oversampler.h"
+#include "profiler.h"
+#include "smoother.h"
 #include <math.h>
+#include <string.h>
+
+#define FOLDBACK_ADAA_ORDER_MAX (2)
+#define FOLDBACK_CHANNELS_MAX (64)
 
 static t_class *foldback_tilde_class;
 
+/* Threshold and history of one channel. */
+struct _foldback_channel {
+    t_float threshold;
+    event_queue_t thresholdEvents; /* Threshold changes waiting for the sample they apply at. */
+    smoother_t thresholdSmoother; /* Glide to new thresholds. */
+    t_float inletThreshold; /* Value the threshold inlet held last block while it was constant. */
+    foldback_adaa_t adaaState;
+    oversampler_t oversampler; /* Filter histories, with -os N. */
+};
+
+typedef struct _foldback_channel foldback_channel_t;
+
 struct _foldback_tilde {
     t_object obj;
     
-    t_float threshold;
     t_float f;
     
-    t_inlet *inThreshold; /* Inlet for controlling threshold. */
-    t_outlet *outSignal; /* Outputs the signal after applying foldback distortion. */
+    /* One entry per channel. With -channels N there are N of them from the start; otherwise a multichannel
+     input sets how many there are when DSP starts. */
+    foldback_channel_t *channels;
+    int numChannels;
+    int numInlets; /* Separate signal inlets and outlets, one per channel with -channels N. */
+    
+    t_float sampleRate; /* Of the blocks the object runs at, from the dsp method; Pd's until DSP first starts. */
+    t_float smoothTime; /* In milliseconds; the smoothers are set up from it again when the sample rate is known. */
+    int smoothMode;
+    /* While a glide or queued change is in progress the threshold is read per sample from thresholdVector,
+     which the channels take turns with. */
+    t_sample *thresholdVector;
+    int vectorSize;
+    
+    /* Copies of the input and threshold vectors whose buffers an earlier channel's output shares, made at the
+     start of every block (see foldback_dsp_copies). */
+    t_sample *inletCopies;
+    int inletCopiesSize;
+    
+    int adaa; /* Order of antiderivative anti-aliasing, 0 for none. */
+    int adaaRequested; /* Order set on the object; 'adaa' is lower while the CPU budget is short. */
+    
+    /* Factor the signal is oversampled by while it is folded, 1 for none. The channels share the scratch
+     buffers, which also hold the oversampled signal and thresholds. */
+    int oversampling;
+    int oversamplingRequested; /* Factor the buffers are made for; the budget may run at a lower one. */
+    oversampler_buffers_t oversamplerBuffers;
+    
+    /* Folding stages in series. Each scales and offsets the output of the one before and folds it again. */
+    int numStages;
+    t_sample stageGains[FOLDBACK_STAGES_MAX];
+    t_sample stageBiases[FOLDBACK_STAGES_MAX];
+    
+    /* Blocks of one channel processed, and how many of those took a fast path (see foldback_fold_fast). */
+    unsigned long blocksProcessed;
+    unsigned long blocksPassed;
+    unsigned long blocksSilent;
+    
+    budget_client_t budget; /* With -adaptive, the quality follows the process-wide CPU budget (see budget.h). */
+    
+    t_inlet **inSignals; /* Signal inlets after the first, with -channels N. */
+    t_inlet *inThreshold; /* Threshold as a signal, or as a float Pd holds for the inlet until the next one. */
+    t_outlet **outSignals; /* Output the signals after applying foldback distortion. */
+    t_outlet *statsOut; /* Block timings on 'stats', in builds with profiling. */
+    
+#ifdef PD_EXTERNALS_PROFILING
+    profiler_t profiler; /* Block timings, sent out of statsOut on 'stats'. */
+#endif
 };
 
 typedef struct _foldback_tilde foldback_tilde_t;
 
 
+/* Sets the order of antiderivative anti-aliasing: 0 turns it off, 1 delays the signal by half a sample and
+ 2 by one sample. */
+void
+foldback_adaa (foldback_tilde_t* obj, t_floatarg arg) {
+    int order = (int)arg;
+    obj->adaaRequested = (order < 0 ? 0 : (order > FOLDBACK_ADAA_ORDER_MAX ? FOLDBACK_ADAA_ORDER_MAX : order));
+    obj->adaa = budget_reduce_order(obj->adaaRequested, obj->budget.level);
+}
+
+/* Follows the quality level of the CPU budget: a lower order of anti-aliasing first, then less oversampling.
+ A new factor starts the filters over, which is heard as a short discontinuity and changes the latency. */
+static void
+foldback_adapt (foldback_tilde_t* obj, int level) {
+    int factor = budget_reduce_factor(obj->oversamplingRequested, level);
+    int c;
+    obj->adaa = budget_reduce_order(obj->adaaRequested, level);
+    if (factor != obj->oversampling) {
+        obj->oversampling = factor;
+        for (c = 0; c < obj->numChannels; c++) {
+            oversampler_init(&obj->channels[c].oversampler, factor);
+        }
+    }
+}
+
+void
+foldback_adaptive (foldback_tilde_t* obj, t_floatarg arg) {
+    budget_client_set_adaptive(&obj->budget, arg != 0.f);
+}
+
+void
+foldback_budget (foldback_tilde_t* obj, t_symbol* sym, int argc, t_atom* argv) {
+    budget_message(&obj->budget, argc, argv);
+}
+
+/* Posts the delay the object adds to its signal, from oversampling and antiderivative anti-aliasing. */
+void
+foldback_latency (foldback_tilde_t* obj) {
+    oversampler_t *oversampler = &obj->channels[0].oversampler;
+    double latency = oversampler_latency(oversampler) + 0.5 * obj->adaa / obj->oversampling;
+    post("foldback~: %dx oversampling, latency %g samples (%g ms)", obj->oversampling, latency,
+         latency * 1000. / obj->sampleRate);
+}
+
+/* Posts how often the block-level fast paths were taken. With profiling compiled in, the block timings also go
+ out of the stats outlet, which is silent otherwise. */
+void
+foldback_stats (foldback_tilde_t* obj) {
+    post("foldback~: %lu blocks, %lu passed through under the threshold, %lu silent",
+         obj->blocksProcessed, obj->blocksPassed, obj->blocksSilent);
+#ifdef PD_EXTERNALS_PROFILING
+    profiler_output(&obj->profiler, obj->statsOut);
+#endif
+}
+
+#ifdef PD_EXTERNALS_PROFILING
+void
+foldback_trace (foldback_tilde_t* obj, t_symbol* sym, int argc, t_atom* argv) {
+    profiler_trace_switch(&obj->profiler, argc, argv);
+}
+#endif
+
+/* Sets the number of folding stages, and optionally the gain and bias of all of them. */
+static void
+foldback_set_stages (foldback_tilde_t* obj, int numStages, int argc, t_atom* argv) {
+    int k;
+    obj->numStages = (numStages < 1 ? 1 : (numStages > FOLDBACK_STAGES_MAX ? FOLDBACK_STAGES_MAX : numStages));
+    for (k = 0; k < FOLDBACK_STAGES_MAX; k++) {
+        if (argc > 0) {
+            obj->stageGains[k] = atom_getfloatarg(0, argc, argv);
+        }
+        if (argc > 1) {
+            obj->stageBiases[k] = atom_getfloatarg(1, argc, argv);
+        }
+    }
+}
+
+/* Handles 'stages N [GAIN [BIAS]]'. */
+void
+foldback_stages (foldback_tilde_t* obj, t_symbol* sym, int argc, t_atom* argv) {
+    if (argc > 0) {
+        foldback_set_stages(obj, (int)atom_getfloat(argv), argc - 1, argv + 1);
+    }
+}
+
+/* Handles 'stage K GAIN [BIAS]', which sets one stage counting from 1. */
+void
+foldback_stage (foldback_tilde_t* obj, t_floatarg index, t_floatarg gain, t_floatarg bias) {
+    int k = (int)index - 1;
+    if (k < 0 || k >= FOLDBACK_STAGES_MAX) {
+        pd_error(obj, "foldback~: stage %d out of range (1 to %d)", k + 1, FOLDBACK_STAGES_MAX);
+        return;
+    }
+    obj->stageGains[k] = gain;
+    obj->stageBiases[k] = bias;
+}
+
+static void
+foldback_channel_init (foldback_channel_t* channel, t_float threshold, t_float inletThreshold, int oversampling) {
+    channel->threshold = threshold;
+    event_queue_init(&channel->thresholdEvents);
+    smoother_init(&channel->thresholdSmoother, threshold);
+    channel->inletThreshold = inletThreshold;
+    memset(&channel->adaaState, 0, sizeof(foldback_adaa_t));
+    oversampler_init(&channel->oversampler, oversampling);
+}
+
+/* Changes the number of channels. Channels that are added start out as copies of the last one's settings. */
+static void
+foldback_set_channels (foldback_tilde_t* obj, int numChannels) {
+    foldback_channel_t *last;
+    int c;
+    
+    if (numChannels == obj->numChannels) {
+        return;
+    }
+    obj->channels = (foldback_channel_t *)resizebytes(obj->channels, obj->numChannels * sizeof(foldback_channel_t),
+                                                      numChannels * sizeof(foldback_channel_t));
+    last = &obj->channels[obj->numChannels - 1];
+    for (c = obj->numChannels; c < numChannels; c++) {
+        foldback_channel_init(&obj->channels[c], last->threshold, last->inletThreshold, obj->oversampling);
+        obj->channels[c].thresholdSmoother = last->thresholdSmoother;
+        smoother_reset(&obj->channels[c].thresholdSmoother, last->threshold);
+    }
+    obj->numChannels = numChannels;
+}
+
 void*
-foldback_tilde_new (t_floatarg arg) {
+foldback_tilde_new (t_symbol* sym, int argc, t_atom* argv) {
     foldback_tilde_t *obj = (foldback_tilde_t *)pd_new(foldback_tilde_class);
-    obj->threshold = arg;
-    obj->inThreshold = floatinlet_new(&obj->obj, &obj->threshold);
-    obj->outSignal = outlet_new(&obj->obj, &s_signal);
+    int numThresholds = 0;
+    int numChannels;
+    int argi;
+    int c;
+    
+    obj->numInlets = 1;
+    obj->smoothTime = 0.f;
+    obj->smoothMode = SMOOTHER_LINEAR;
+    obj->adaa = obj->adaaRequested = 0;
+    obj->oversampling = 1;
+    oversampler_buffers_init(&obj->oversamplerBuffers);
+    budget_client_init(&obj->budget, obj, (budget_adapt_t)foldback_adapt, 0);
+    obj->blocksProcessed = obj->blocksPassed = obj->blocksSilent = 0;
+    obj->numStages = 1;
+    for (c = 0; c < FOLDBACK_STAGES_MAX; c++) {
+        obj->stageGains[c] = 1.f;
+        obj->stageBiases[c] = 0.f;
+    }
+    
+    /* Thresholds come first, one per channel; the last one given carries on to any further channels.
+     Optional flags follow them:
+     -channels N: N signal inlets and outlets, all processed together.
+     -smooth MS [lin|exp]: glide to new thresholds over MS milliseconds, linearly (default) or exponentially.
+     -adaa N: antiderivative anti-aliasing of order N, 0 (default), 1 or 2.
+     -stages N [GAIN [BIAS]]: N folding stages in series, each given GAIN (default 1) and BIAS (default 0).
+     -os N: fold at N times the sample rate, 2, 4 or 8 (see foldback_latency for the delay this adds).
+     -adaptive: lower the anti-aliasing and oversampling while the process-wide CPU budget is exceeded. */
+    while (numThresholds < argc && argv[numThresholds].a_type == A_FLOAT) {
+        numThresholds++;
+    }
+    for (argi = numThresholds; argi < argc; argi++) {
+        t_symbol *flag = atom_getsymbol(&argv[argi]);
+        if (strcmp(flag->s_name, "-channels") == 0 && argi + 1 < argc) {
+            int count = (int)atom_getfloat(&argv[++argi]);
+            obj->numInlets = (count < 1 ? 1 : (count > FOLDBACK_CHANNELS_MAX ? FOLDBACK_CHANNELS_MAX : count));
+        } else if (strcmp(flag->s_name, "-smooth") == 0 && argi + 1 < argc) {
+            obj->smoothTime = atom_getfloat(&argv[++argi]);
+            if (argi + 1 < argc && argv[argi + 1].a_type == A_SYMBOL
+                && smoother_mode_find(argv[argi + 1].a_w.w_symbol) >= 0) {
+                obj->smoothMode = smoother_mode_find(argv[++argi].a_w.w_symbol);
+            }
+        } else if (strcmp(flag->s_name, "-adaa") == 0 && argi + 1 < argc) {
+            foldback_adaa(obj, atom_getfloat(&argv[++argi]));
+        } else if (strcmp(flag->s_name, "-os") == 0 && argi + 1 < argc) {
+            obj->oversampling = oversampler_factor_find((int)atom_getfloat(&argv[++argi]));
+        } else if (strcmp(flag->s_name, "-adaptive") == 0) {
+            obj->budget.adaptive = 1;
+        } else if (strcmp(flag->s_name, "-stages") == 0 && argi + 1 < argc) {
+            int numStages = (int)atom_getfloat(&argv[++argi]);
+            int numValues = 0;
+            while (numValues < 2 && argi + 1 + numValues < argc && argv[argi + 1 + numValues].a_type == A_FLOAT) {
+                numValues++;
+            }
+            foldback_set_stages(obj, numStages, numValues, argv + argi + 1);
+            argi += numValues;
+        } else {
+            pd_error(obj, "foldback~: unknown argument '%s'", flag->s_name);
+        }
+    }
+    obj->oversamplingRequested = obj->oversampling;
+    obj->sampleRate = sys_getsr();
+    
+    /* A multichannel input may bring more channels than thresholds were given for; they are added then. */
+    numChannels = (numThresholds > obj->numInlets ? numThresholds : obj->numInlets);
+    if (numChannels > FOLDBACK_CHANNELS_MAX) {
+        numChannels = FOLDBACK_CHANNELS_MAX;
+    }
+    obj->channels = (foldback_channel_t *)getbytes(numChannels * sizeof(foldback_channel_t));
+    obj->numChannels = numChannels;
+    for (c = 0; c < numChannels; c++) {
+        t_float threshold = (numThresholds == 0 ? 0.f : atom_getfloat(&argv[c < numThresholds ? c : numThresholds - 1]));
+        /* The threshold inlet holds the first threshold, which is no change for any of the channels. */
+        foldback_channel_init(&obj->channels[c], threshold, atom_getfloatarg(0, argc, argv), obj->oversampling);
+        smoother_configure(&obj->channels[c].thresholdSmoother, obj->smoothTime, obj->smoothMode, obj->sampleRate);
+    }
+    obj->thresholdVector = NULL;
+    obj->vectorSize = 0;
+    obj->inletCopies = NULL;
+    obj->inletCopiesSize = 0;
+    
+    obj->inSignals = (t_inlet **)getbytes(obj->numInlets * sizeof(t_inlet *));
+    for (c = 1; c < obj->numInlets; c++) {
+        obj->inSignals[c] = inlet_new(&obj->obj, &obj->obj.ob_pd, &s_signal, &s_signal);
+    }
+    obj->inThreshold = signalinlet_new(&obj->obj, obj->channels[0].threshold);
+    obj->outSignals = (t_outlet **)getbytes(obj->numInlets * sizeof(t_outlet *));
+    for (c = 0; c < obj->numInlets; c++) {
+        obj->outSignals[c] = outlet_new(&obj->obj, &s_signal);
+    }
+    obj->statsOut = outlet_new(&obj->obj, &s_list);
+#ifdef PD_EXTERNALS_PROFILING
+    profiler_init(&obj->profiler, "foldback~");
+#endif
     
 #if DEBUG
-    post("DEBUG: foldback~ args: %f", obj->threshold);
+    post("DEBUG: foldback~ args: %f", obj->channels[0].threshold);
 #endif
     
     return (void *)obj;
@@ -70,51 +354,578 @@ foldback_tilde_new (t_floatarg arg) {
 
 void
 foldback_tilde_free (foldback_tilde_t* obj) {
+    int c;
+    for (c = 1; c < obj->numInlets; c++) {
+        inlet_free(obj->inSignals[c]);
+    }
     inlet_free(obj->inThreshold);
-    outlet_free(obj->outSignal);
+    for (c = 0; c < obj->numInlets; c++) {
+        outlet_free(obj->outSignals[c]);
+    }
+    outlet_free(obj->statsOut);
+    freebytes(obj->inSignals, obj->numInlets * sizeof(t_inlet *));
+    freebytes(obj->outSignals, obj->numInlets * sizeof(t_outlet *));
+    freebytes(obj->channels, obj->numChannels * sizeof(foldback_channel_t));
+    if (obj->thresholdVector) {
+        freebytes(obj->thresholdVector, obj->vectorSize * sizeof(t_sample));
+    }
+    if (obj->inletCopies) {
+        freebytes(obj->inletCopies, obj->inletCopiesSize * sizeof(t_sample));
+    }
+    oversampler_buffers_free(&obj->oversamplerBuffers);
+}
+
+/* Handles the 'threshold' message: one value for every channel, or one per channel with the last carrying
+ on. While DSP runs, each change is queued so it takes effect at the sample it was sent at. */
+void
+foldback_threshold (foldback_tilde_t* obj, t_symbol* sym, int argc, t_atom* argv) {
+    int c;
+    if (argc == 0) {
+        return;
+    }
+    for (c = 0; c < obj->numChannels; c++) {
+        foldback_channel_t *channel = &obj->channels[c];
+        t_float threshold = atom_getfloat(&argv[c < argc ? c : argc - 1]);
+        t_float dropped;
+        if (!canvas_dspstate) {
+            channel->threshold = threshold;
+            smoother_reset(&channel->thresholdSmoother, threshold);
+        } else if (event_queue_push(&channel->thresholdEvents, threshold, &dropped)) {
+            channel->threshold = dropped;
+            smoother_set_target(&channel->thresholdSmoother, dropped);
+        }
+    }
+}
+
+/* Sets the glide time in milliseconds (0 turns it off) and, optionally, its curve: lin or exp. */
+void
+foldback_smooth (foldback_tilde_t* obj, t_floatarg time, t_symbol* mode) {
+    int smoothMode = (*mode->s_name ? smoother_mode_find(mode) : obj->smoothMode);
+    int c;
+    if (smoothMode < 0) {
+        pd_error(obj, "foldback~: unknown smoothing mode '%s'", mode->s_name);
+        return;
+    }
+    obj->smoothTime = time;
+    obj->smoothMode = smoothMode;
+    for (c = 0; c < obj->numChannels; c++) {
+        smoother_configure(&obj->channels[c].thresholdSmoother, time, smoothMode, obj->sampleRate);
+    }
+}
+
+/* The kernels are the t_sample instantiations of the core in foldback.h. */
+typedef void (*foldback_kernel_t)(const t_sample* in, t_sample* out, int numSamples, t_sample threshold);
+typedef void (*foldback_varying_kernel_t)(const t_sample* in, t_sample* out, int numSamples, const t_sample* thresholds);
+typedef void (*foldback_stages_kernel_t)(const t_sample* in, t_sample* out, int numSamples,
+                                         const t_sample* thresholds, int step,
+                                         const t_sample* gains, const t_sample* biases, int numStages);
+typedef t_sample (*foldback_peak_kernel_t)(const t_sample* in, int numSamples, t_sample center, t_sample limit);
+
+/* Kernels for the running CPU, chosen in foldback_tilde_setup. The stage kernels are by stage count. */
+static foldback_kernel_t foldback_kernel = DSP_PD(foldback_process);
+static foldback_varying_kernel_t foldback_varying_kernel = DSP_PD(foldback_process_varying);
+static foldback_stages_kernel_t foldback_stages_kernels[FOLDBACK_STAGES_MAX + 1];
+static foldback_peak_kernel_t foldback_peak_kernel = DSP_PD(foldback_peak_process);
+
+/* A single stage that leaves its input as it is takes the plain fold kernels. */
+static int
+foldback_has_stages (const foldback_tilde_t* obj) {
+    return (obj->numStages > 1 || obj->stageGains[0] != 1.f || obj->stageBiases[0] != 0.f);
+}
+
+/* Keeps the ADAA history of a channel while anti-aliasing is off. It is the signal the last stage folds,
+ which with stages is the output of the ones before it with the last one's gain and bias applied. Like
+ foldback_adaa_skip, this has to come before the output is written. */
+static void
+foldback_skip (foldback_tilde_t* obj, foldback_adaa_t* state, const t_sample* in, int numSamples,
+               const t_sample* thresholds, int step) {
+    int last = obj->numStages - 1;
+    int start = (numSamples > 2 ? numSamples - 2 : 0);
+    t_sample history[2];
+    int i;
+    
+    if (!foldback_has_stages(obj)) {
+        DSP_PD(foldback_adaa_skip)(state, in, numSamples);
+        return;
+    }
+    DSP_PD(foldback_stages_process)(in + start, history, numSamples - start, thresholds + start * step, step,
+                                    obj->stageGains, obj->stageBiases, last);
+    for (i = 0; i < numSamples - start; i++) {
+        history[i] = history[i] * obj->stageGains[last] + obj->stageBiases[last];
+    }
+    DSP_PD(foldback_adaa_skip)(state, history, numSamples - start);
 }
 
+/* Runs the stages with the order of anti-aliasing set on the object, which applies to the last stage. */
+static void
+foldback_fold_stages (foldback_tilde_t* obj, foldback_channel_t* channel, const t_sample* in, t_sample* out,
+                      int numSamples, const t_sample* thresholds, int step) {
+    int last = obj->numStages - 1;
+    t_sample gain = obj->stageGains[last];
+    t_sample bias = obj->stageBiases[last];
+    int i;
+    
+    if (obj->adaa == 0) {
+        foldback_skip(obj, &channel->adaaState, in, numSamples, thresholds, step);
+        foldback_stages_kernels[obj->numStages](in, out, numSamples, thresholds, step,
+                                                obj->stageGains, obj->stageBiases, obj->numStages);
+        return;
+    }
+    
+    /* The output is written before the anti-aliasing reads the thresholds, and a threshold signal may be in
+     the same buffer. Only one at the block's own rate can be, and then the threshold vector is free. */
+    if (step && thresholds == out) {
+        memcpy(obj->thresholdVector, thresholds, numSamples * sizeof(t_sample));
+        thresholds = obj->thresholdVector;
+    }
+    if (last > 0) {
+        foldback_stages_kernels[last](in, out, numSamples, thresholds, step, obj->stageGains, obj->stageBiases, last);
+        in = out;
+    }
+    for (i = 0; i < numSamples; i++) {
+        out[i] = in[i] * gain + bias;
+    }
+    if (obj->adaa == 1) {
+        DSP_PD(foldback_adaa1_process)(&channel->adaaState, out, out, numSamples, thresholds, step);
+    } else {
+        DSP_PD(foldback_adaa2_process)(&channel->adaaState, out, out, numSamples, thresholds, step);
+    }
+}
+
+/* Block-level fast paths for a constant threshold, decided by one scan for the block's peak. A block that
+ stays within the threshold is copied through unchanged (or left alone when the output is the input), and
+ a silent block gives silence, or with stages the constant that silence folds to. With ADAA neither holds
+ in general; only silence after silence is skipped, without stages. The scan stops at the first sample that
+ rules the fast paths out, so a block that folds costs little more than the fold. The ADAA history of the
+ channel is kept up to date if 'state' is given. Returns the path taken, FOLDBACK_FOLDED if none was. */
+enum {
+    FOLDBACK_FOLDED = 0,
+    FOLDBACK_PASSED = 1,
+    FOLDBACK_SILENT = 2
+};
+
+static int
+foldback_fold_fast (foldback_tilde_t* obj, foldback_adaa_t* state, const t_sample* in, t_sample* out,
+                    int numSamples, t_float threshold) {
+    int stages = foldback_has_stages(obj);
+    int passes = (!obj->adaa && !stages && threshold > 0.f);
+    t_sample peak;
+    
+    if (obj->adaa && (stages || state->x1 != 0. || state->x2 != 0.)) {
+        return FOLDBACK_FOLDED;
+    }
+    peak = foldback_peak_kernel(in, numSamples, 0.f, (passes ? threshold : 0.f));
+    if (peak == 0.f) {
+        t_sample value = 0.f;
+        int i;
+        if (stages && threshold > 0.f) {
+            DSP_PD(foldback_stages_process)(&value, &value, 1, &threshold, 0, obj->stageGains,
+                                            obj->stageBiases, obj->numStages);
+        }
+        if (state) {
+            foldback_skip(obj, state, in, numSamples, &threshold, 0);
+        }
+        for (i = 0; i < numSamples; i++) {
+            out[i] = value;
+        }
+        return FOLDBACK_SILENT;
+    }
+    if (passes && peak <= threshold) {
+        if (state) {
+            DSP_PD(foldback_adaa_skip)(state, in, numSamples);
+        }
+        if (in != out) {
+            memcpy(out, in, numSamples * sizeof(t_sample));
+        }
+        return FOLDBACK_PASSED;
+    }
+    return FOLDBACK_FOLDED;
+}
+
+static void
+foldback_count_blocks (foldback_tilde_t* obj, int path, int numBlocks) {
+    obj->blocksProcessed += numBlocks;
+    if (path == FOLDBACK_PASSED) {
+        obj->blocksPassed += numBlocks;
+    } else if (path == FOLDBACK_SILENT) {
+        obj->blocksSilent += numBlocks;
+    }
+}
+
+/* Folds a block of one channel with the order of anti-aliasing set on the object, at the rate the block is
+ at. */
+static void
+foldback_fold_block (foldback_tilde_t* obj, foldback_channel_t* channel, const t_sample* in, t_sample* out,
+               int numSamples, const t_sample* thresholds, int step) {
+    foldback_adaa_t *state = &channel->adaaState;
+    int path = (step == 0 ? foldback_fold_fast(obj, state, in, out, numSamples, thresholds[0]) : FOLDBACK_FOLDED);
+    
+    foldback_count_blocks(obj, path, 1);
+    if (path != FOLDBACK_FOLDED) {
+        return;
+    }
+    if (foldback_has_stages(obj)) {
+        foldback_fold_stages(obj, channel, in, out, numSamples, thresholds, step);
+        return;
+    }
+    if (obj->adaa == 1) {
+        DSP_PD(foldback_adaa1_process)(state, in, out, numSamples, thresholds, step);
+        return;
+    }
+    if (obj->adaa == 2) {
+        DSP_PD(foldback_adaa2_process)(state, in, out, numSamples, thresholds, step);
+        return;
+    }
+    
+    DSP_PD(foldback_adaa_skip)(state, in, numSamples);
+    if (step == 0) {
+        foldback_kernel(in, out, numSamples, thresholds[0]);
+    } else {
+        foldback_varying_kernel(in, out, numSamples, thresholds);
+    }
+}
+
+/* Folds a block of one channel, oversampled if the object is set to. The thresholds are held for each of
+ the samples they cover at the higher rate. */
+static void
+foldback_fold (foldback_tilde_t* obj, foldback_channel_t* channel, const t_sample* in, t_sample* out,
+               int numSamples, const t_sample* thresholds, int step) {
+    oversampler_buffers_t *buffers = &obj->oversamplerBuffers;
+    int factor = obj->oversampling;
+    t_sample *signal = buffers->vectors[0];
+    
+    if (factor == 1) {
+        foldback_fold_block(obj, channel, in, out, numSamples, thresholds, step);
+        return;
+    }
+    oversampler_up(&channel->oversampler, buffers, in, signal, numSamples);
+    if (step) {
+        oversampler_hold(thresholds, buffers->vectors[1], numSamples, factor);
+        thresholds = buffers->vectors[1];
+    }
+    foldback_fold_block(obj, channel, signal, signal, numSamples * factor, thresholds, step);
+    oversampler_down(&channel->oversampler, buffers, signal, out, numSamples);
+}
+
+static int
+foldback_block_is_constant (const t_sample* in, int numSamples) {
+    return (foldback_peak_kernel(in, numSamples, in[0], 0.f) == 0.f);
+}
+
+/* Brings a channel's threshold up to date with its inlet for this block. Pd gives no way to tell whether
+ the threshold inlet is connected, but an unconnected one holds the last float sent to it for the whole
+ block. A new constant there is a float sent to it (or a signal holding still), which takes effect from the
+ start of the block. Returns 0 if the inlet changes within the block: that is a signal, which is followed
+ sample by sample and overrides queued 'threshold' messages and any glide in progress. */
+static int
+foldback_channel_follow_inlet (foldback_channel_t* channel, const t_sample* thresholdIn, int numSamples,
+                               int constant) {
+    if (!constant) {
+        while (channel->thresholdEvents.count > 0) {
+            event_queue_pop(&channel->thresholdEvents);
+        }
+        channel->threshold = channel->inletThreshold = thresholdIn[numSamples - 1];
+        smoother_reset(&channel->thresholdSmoother, channel->threshold);
+        return 0;
+    }
+    if (thresholdIn[0] != channel->inletThreshold) {
+        channel->threshold = channel->inletThreshold = thresholdIn[0];
+        smoother_set_target(&channel->thresholdSmoother, channel->threshold);
+    }
+    return 1;
+}
+
+static void
+foldback_channel_perform (foldback_tilde_t* obj, foldback_channel_t* channel, const t_sample* in,
+                          const t_sample* thresholdIn, t_sample* out, int numSamples, int constant) {
+    event_queue_t *queue = &channel->thresholdEvents;
+    smoother_t *smoother = &channel->thresholdSmoother;
+    int position = 0;
+    int offset;
+    
+    if (!foldback_channel_follow_inlet(channel, thresholdIn, numSamples, constant)) {
+        foldback_fold(obj, channel, in, out, numSamples, thresholdIn, 1);
+        return;
+    }
+    
+    /* A settled threshold with no changes queued is a constant for the block. */
+    if (queue->count == 0 && smoother_settled(smoother)) {
+        foldback_fold(obj, channel, in, out, numSamples, &channel->threshold, 0);
+        return;
+    }
+    
+    /* Otherwise the threshold for each sample is written out first: each queued change starts at its own
+     sample, gliding there if a smoothing time is set. */
+    while ((offset = event_queue_next(queue, numSamples)) < numSamples) {
+        smoother_fill(smoother, obj->thresholdVector + position, offset - position);
+        position = offset;
+        channel->threshold = event_queue_pop(queue);
+        smoother_set_target(smoother, channel->threshold);
+    }
+    smoother_fill(smoother, obj->thresholdVector + position, numSamples - position);
+    foldback_fold(obj, channel, in, out, numSamples, obj->thresholdVector, 1);
+}
+
+/* Arguments are the object, the block size, the number of channels, and then an input, threshold and
+ output vector for each channel. */
 t_int*
 foldback_perform (t_int* args) {
     foldback_tilde_t *obj = (foldback_tilde_t *)args[1];
-    t_sample *in = (t_sample *)args[2];
-    t_sample *out = (t_sample *)args[3];
-    int numSamples = (int)args[4];
+    int numSamples = (int)args[2];
+    int numChannels = (int)args[3];
+    t_sample **vectors = (t_sample **)(args + 4);
+    const t_sample *lastThresholdIn = NULL;
+    int constant = 1;
+    int contiguous = (obj->adaa == 0 && obj->oversampling == 1);
+    int path;
+    int c;
     
-    t_float threshold = obj->threshold;
+    /* The common case for a bus is every channel settled at the same threshold, with the channels one after
+     another in memory as they are in a multichannel signal. Then it is a single run of the kernel. */
+    for (c = 0; c < numChannels && contiguous; c++) {
+        foldback_channel_t *channel = &obj->channels[c];
+        const t_sample *thresholdIn = vectors[3 * c + 1];
+        if (thresholdIn != lastThresholdIn) {
+            constant = foldback_block_is_constant(thresholdIn, numSamples);
+            lastThresholdIn = thresholdIn;
+        }
+        contiguous = (constant && thresholdIn[0] == channel->inletThreshold
+                      && channel->thresholdEvents.count == 0 && smoother_settled(&channel->thresholdSmoother)
+                      && channel->threshold == obj->channels[0].threshold
+                      && vectors[3 * c] == vectors[0] + c * numSamples
+                      && vectors[3 * c + 2] == vectors[2] + c * numSamples);
+    }
+    if (contiguous) {
+        for (c = 0; c < numChannels; c++) {
+            foldback_skip(obj, &obj->channels[c].adaaState, vectors[3 * c], numSamples,
+                          &obj->channels[0].threshold, 0);
+        }
+        path = foldback_fold_fast(obj, NULL, vectors[0], vectors[2], numSamples * numChannels,
+                                  obj->channels[0].threshold);
+        foldback_count_blocks(obj, path, numChannels);
+        if (path != FOLDBACK_FOLDED) {
+            return (args + 4 + 3 * numChannels);
+        }
+        if (foldback_has_stages(obj)) {
+            foldback_stages_kernels[obj->numStages](vectors[0], vectors[2], numSamples * numChannels,
+                                                    &obj->channels[0].threshold, 0,
+                                                    obj->stageGains, obj->stageBiases, obj->numStages);
+        } else {
+            foldback_kernel(vectors[0], vectors[2], numSamples * numChannels, obj->channels[0].threshold);
+        }
+        return (args + 4 + 3 * numChannels);
+    }
     
-    while (numSamples--) {
-        t_sample sample = *in++;
-        t_sample outSample = sample;
-
-        if ((sample > threshold) || (sample < -threshold)) {
-            outSample = fabsf(fabsf(fmodf(sample - threshold, threshold * 4.f)) - threshold * 2.f) - threshold;
+    lastThresholdIn = NULL;
+    for (c = 0; c < numChannels; c++) {
+        const t_sample *thresholdIn = vectors[3 * c + 1];
+        if (thresholdIn != lastThresholdIn) {
+            constant = foldback_block_is_constant(thresholdIn, numSamples);
+            lastThresholdIn = thresholdIn;
         }
-        
-        *out++ = outSample;
+        foldback_channel_perform(obj, &obj->channels[c], vectors[3 * c], thresholdIn, vectors[3 * c + 2],
+                                 numSamples, constant);
     }
     
     /* Return requirement from documentation specifies that the function must return a pointer
-     to the memory directly behind the arguments list (in this case, the number of pointer
-     arguments given (4) plus 1. */
-    return (args + 5);
+     to the memory directly behind the arguments list (in this case, the 3 counts and pointers given
+     and 3 vectors per channel, plus 1). */
+    return (args + 4 + 3 * numChannels);
+}
+
+/* Pd gives an outlet the buffer of an inlet signal nobody else reads any more, so an output may share its
+ buffer with the input or threshold of a later channel (with a single threshold signal, all of them read the
+ one that comes back first). As the channels are folded one after another, that vector would be overwritten
+ before it is read. Each such vector is pointed at a copy in 'args' instead, and its buffer is written to
+ 'sources' in the order of the copies. Returns the number of copies to be made at the start of every block. */
+static int
+foldback_dsp_copies (foldback_tilde_t* obj, t_int* args, int numChannels, int numSamples, t_sample** sources) {
+    int copies[2 * FOLDBACK_CHANNELS_MAX];
+    int numCopies = 0;
+    int c, k, v;
+    
+    /* The vectors of channel v / 2 are its input (v even) and its threshold (v odd). */
+    for (v = 0; v < 2 * numChannels; v++) {
+        t_sample *vector = (t_sample *)args[3 + 3 * (v / 2) + v % 2];
+        copies[v] = -1;
+        for (c = 0; c < v / 2; c++) {
+            if ((t_sample *)args[5 + 3 * c] == vector) {
+                break;
+            }
+        }
+        if (c == v / 2) {
+            continue;
+        }
+        for (k = 0; k < numCopies; k++) {
+            if (sources[k] == vector) {
+                break;
+            }
+        }
+        if (k == numCopies) {
+            sources[numCopies++] = vector;
+        }
+        copies[v] = k;
+    }
+    if (numCopies * numSamples > obj->inletCopiesSize) {
+        obj->inletCopies = (t_sample *)resizebytes(obj->inletCopies, obj->inletCopiesSize * sizeof(t_sample),
+                                                   numCopies * numSamples * sizeof(t_sample));
+        obj->inletCopiesSize = numCopies * numSamples;
+    }
+    for (v = 0; v < 2 * numChannels; v++) {
+        if (copies[v] >= 0) {
+            args[3 + 3 * (v / 2) + v % 2] = (t_int)(obj->inletCopies + copies[v] * numSamples);
+        }
+    }
+    return numCopies;
 }
 
 void
 foldback_dsp (foldback_tilde_t* obj, t_signal** sp) {
-    /* Signal pointer (sp) goes clockwise from the left inlet around to the left outlet. 
-     The first (0) is the signal inlet, and the next (1) is the signal outlet. */
-    dsp_add(foldback_perform, 4, obj, sp[0]->s_vec, sp[1]->s_vec, sp[0]->s_n);
+    /* Signal pointer (sp) goes clockwise from the left inlet around to the left outlet. The signal inlets
+     come first (0 to numInlets - 1), then the threshold inlet (numInlets), and then the signal outlets. */
+    t_signal **inputs = sp;
+    t_signal *threshold = sp[obj->numInlets];
+    t_signal **outputs = sp + obj->numInlets + 1;
+    int numSamples = sp[0]->s_n;
+    int numThresholdChannels = 1;
+    int numChannels = obj->numInlets;
+    t_sample *sources[2 * FOLDBACK_CHANNELS_MAX];
+    int numCopies;
+    t_int *args;
+    int c;
+    
+#ifdef CLASS_MULTICHANNEL
+    /* Without -channels, the channels of a multichannel input are folded, each with its own threshold
+     channel if the threshold inlet has one for it. */
+    if (obj->numInlets == 1) {
+        numChannels = (sp[0]->s_nchans > FOLDBACK_CHANNELS_MAX ? FOLDBACK_CHANNELS_MAX : sp[0]->s_nchans);
+        numThresholdChannels = threshold->s_nchans;
+    }
+    for (c = 0; c < obj->numInlets; c++) {
+        signal_setmultiout(&outputs[c], (obj->numInlets == 1 ? numChannels : 1));
+    }
+#endif
+    foldback_set_channels(obj, numChannels);
+    
+    if (numSamples > obj->vectorSize) {
+        obj->thresholdVector = (t_sample *)resizebytes(obj->thresholdVector, obj->vectorSize * sizeof(t_sample),
+                                                       numSamples * sizeof(t_sample));
+        obj->vectorSize = numSamples;
+    }
+    obj->sampleRate = sp[0]->s_sr;
+    for (c = 0; c < numChannels; c++) {
+        smoother_configure(&obj->channels[c].thresholdSmoother, obj->smoothTime, obj->smoothMode, obj->sampleRate);
+        event_queue_dsp(&obj->channels[c].thresholdEvents, numSamples, obj->sampleRate);
+    }
+    if (obj->oversamplingRequested > 1) {
+        oversampler_buffers_resize(&obj->oversamplerBuffers, numSamples, obj->oversamplingRequested, 2);
+    }
+    
+    args = (t_int *)getbytes((3 + 3 * numChannels) * sizeof(t_int));
+    args[0] = (t_int)obj;
+    args[1] = (t_int)numSamples;
+    args[2] = (t_int)numChannels;
+    for (c = 0; c < numChannels; c++) {
+        int multichannel = (obj->numInlets == 1);
+        args[3 + 3 * c] = (t_int)(multichannel ? inputs[0]->s_vec + c * numSamples : inputs[c]->s_vec);
+        args[4 + 3 * c] = (t_int)(threshold->s_vec + (c % numThresholdChannels) * numSamples);
+        args[5 + 3 * c] = (t_int)(multichannel ? outputs[0]->s_vec + c * numSamples : outputs[c]->s_vec);
+    }
+    numCopies = foldback_dsp_copies(obj, args, numChannels, numSamples, sources);
+#ifdef PD_EXTERNALS_PROFILING
+    profiler_dsp_begin(&obj->profiler);
+#endif
+    budget_dsp_begin(&obj->budget);
+    for (c = 0; c < numCopies; c++) {
+        dsp_add_copy(sources[c], obj->inletCopies + c * numSamples, numSamples);
+    }
+    dsp_addv(foldback_perform, 3 + 3 * numChannels, args);
+    budget_dsp_end(&obj->budget);
+#ifdef PD_EXTERNALS_PROFILING
+    profiler_dsp_end(&obj->profiler);
+#endif
+    freebytes(args, (3 + 3 * numChannels) * sizeof(t_int));
 }
 
 void
 foldback_tilde_setup (void) {
+    int k;
+    
     foldback_tilde_class = class_new(gensym("foldback~"),
                                      (t_newmethod)foldback_tilde_new,
                                      (t_method)foldback_tilde_free,
-                                     sizeof(foldback_tilde_t), CLASS_DEFAULT, A_DEFFLOAT, 0);
+                                     sizeof(foldback_tilde_t),
+#ifdef CLASS_MULTICHANNEL
+                                     CLASS_DEFAULT | CLASS_MULTICHANNEL,
+#else
+                                     CLASS_DEFAULT,
+#endif
+                                     A_GIMME, 0);
     
     class_addmethod(foldback_tilde_class, (t_method)foldback_dsp, gensym("dsp"), 0);
+    /* 'threshold' messages change the threshold at the exact sample they are sent at, with any glide set. */
+    class_addmethod(foldback_tilde_class, (t_method)foldback_threshold, gensym("threshold"), A_GIMME, 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_smooth, gensym("smooth"), A_FLOAT, A_DEFSYM, 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_adaa, gensym("adaa"), A_FLOAT, 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_stages, gensym("stages"), A_GIMME, 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_stats, gensym("stats"), 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_latency, gensym("latency"), 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_adaptive, gensym("adaptive"), A_FLOAT, 0);
+    class_addmethod(foldback_tilde_class, (t_method)foldback_budget, gensym("budget"), A_GIMME, 0);
+#ifdef PD_EXTERNALS_PROFILING
+    class_addmethod(foldback_tilde_class, (t_method)foldback_trace, gensym("trace"), A_GIMME, 0);
+#endif
+    class_addmethod(foldback_tilde_class, (t_method)foldback_stage, gensym("stage"), A_FLOAT, A_FLOAT, A_DEFFLOAT, 0);
     /* Float messages to the left inlet modifies the waveform's frequency. */
     CLASS_MAINSIGNALIN(foldback_tilde_class, foldback_tilde_t, f);
+    
+    for (k = 0; k <= FOLDBACK_STAGES_MAX; k++) {
+        foldback_stages_kernels[k] = DSP_PD(foldback_stages_process);
+    }
+    
+    /* The vector kernels are built for both sample types, except that 32-bit ARM has no double lanes. */
+#if defined(CPU_X86)
+    if (cpu_features() & CPU_FEATURE_AVX2) {
+        foldback_kernel = DSP_PD(foldback_process_avx2);
+        foldback_peak_kernel = DSP_PD(foldback_peak_avx2);
+        foldback_varying_kernel = DSP_PD(foldback_process_varying_avx2);
+        foldback_stages_kernels[1] = DSP_PD(foldback_stages_any_avx2);
+        foldback_stages_kernels[2] = DSP_PD(foldback_stages2_avx2);
+        foldback_stages_kernels[3] = DSP_PD(foldback_stages3_avx2);
+        foldback_stages_kernels[4] = DSP_PD(foldback_stages4_avx2);
+        foldback_stages_kernels[5] = DSP_PD(foldback_stages5_avx2);
+        foldback_stages_kernels[6] = DSP_PD(foldback_stages6_avx2);
+        for (k = 7; k <= FOLDBACK_STAGES_MAX; k++) {
+            foldback_stages_kernels[k] = DSP_PD(foldback_stages_any_avx2);
+        }
+    } else if (cpu_features() & CPU_FEATURE_SSE2) {
+        foldback_kernel = DSP_PD(foldback_process_sse2);
+        foldback_peak_kernel = DSP_PD(foldback_peak_sse2);
+        foldback_varying_kernel = DSP_PD(foldback_process_varying_sse2);
+        foldback_stages_kernels[1] = DSP_PD(foldback_stages_any_sse2);
+        foldback_stages_kernels[2] = DSP_PD(foldback_stages2_sse2);
+        foldback_stages_kernels[3] = DSP_PD(foldback_stages3_sse2);
+        foldback_stages_kernels[4] = DSP_PD(foldback_stages4_sse2);
+        foldback_stages_kernels[5] = DSP_PD(foldback_stages5_sse2);
+        foldback_stages_kernels[6] = DSP_PD(foldback_stages6_sse2);
+        for (k = 7; k <= FOLDBACK_STAGES_MAX; k++) {
+            foldback_stages_kernels[k] = DSP_PD(foldback_stages_any_sse2);
+        }
+    }
+#elif defined(CPU_NEON) && (PD_FLOATSIZE == 32 || defined(SIMD_NEON_F64))
+    if (cpu_features() & CPU_FEATURE_NEON) {
+        foldback_kernel = DSP_PD(foldback_process_neon);
+        foldback_peak_kernel = DSP_PD(foldback_peak_neon);
+        foldback_varying_kernel = DSP_PD(foldback_process_varying_neon);
+        foldback_stages_kernels[1] = DSP_PD(foldback_stages_any_neon);
+        foldback_stages_kernels[2] = DSP_PD(foldback_stages2_neon);
+        foldback_stages_kernels[3] = DSP_PD(foldback_stages3_neon);
+        foldback_stages_kernels[4] = DSP_PD(foldback_stages4_neon);
+        foldback_stages_kernels[5] = DSP_PD(foldback_stages5_neon);
+        foldback_stages_kernels[6] = DSP_PD(foldback_stages6_neon);
+        for (k = 7; k <= FOLDBACK_STAGES_MAX; k++) {
+            foldback_stages_kernels[k] = DSP_PD(foldback_stages_any_neon);
+        }
+    }
+#endif
 }
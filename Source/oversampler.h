@@ -0,0 +1,330 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Oversampling for nonlinear processing. A block is brought up to 2, 4 or 8 times the sample
+//  rate by a cascade of 2x stages, processed there, and brought back down by the same cascade.
+//  Each stage is a linear-phase half-band FIR split into its two polyphase branches: one is a
+//  short symmetric FIR at the lower rate, the other a plain delay, so only half of the taps
+//  ever cost anything. The filters are run tap by tap over whole blocks, which keeps the inner
+//  loops free of dependencies between samples and lets the compiler vectorize them.
+//
+//  The state of one signal (the filter histories) is kept apart from the scratch buffers, which
+//  all signals of an object can share since they are only used within a call.
+//
+
+#ifndef OVERSAMPLER_H
+#define OVERSAMPLER_H
+
+#include "m_pd.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+# define OVERSAMPLER_INLINE __inline
+#else
+# define OVERSAMPLER_INLINE inline
+#endif
+
+#define OVERSAMPLER_FACTOR_MAX (8)
+#define OVERSAMPLER_STAGES_MAX (3) /* 2x stages needed for OVERSAMPLER_FACTOR_MAX. */
+#define OVERSAMPLER_LENGTH_MAX (16) /* Taps of the longest polyphase branch, over 2. */
+#define OVERSAMPLER_VECTORS_MAX (3) /* Blocks at the oversampled rate an object can have for its own use. */
+#define OVERSAMPLER_ALIGNMENT (32) /* Bytes, enough for the widest vectors the kernels use. */
+
+/* Taps of the FIR branch of each stage, over 2, from the stage next to the base rate up. The first stage
+ has to keep the whole audio band and reject everything above it in a narrow transition band; later ones
+ only have to keep the audio band, which is a smaller and smaller part of their own. */
+static const int oversampler_lengths[OVERSAMPLER_STAGES_MAX] = { 16, 6, 4 };
+
+/* Kaiser window parameter of each stage's design, for about 90 dB of stopband attenuation. */
+static const double oversampler_betas[OVERSAMPLER_STAGES_MAX] = { 9., 9., 9. };
+
+/* Filter histories of one signal. */
+struct _oversampler {
+    int factor; /* 1, 2, 4 or 8. A factor of 1 passes the signal through. */
+    int numStages;
+    t_sample upHistory[OVERSAMPLER_STAGES_MAX][2 * OVERSAMPLER_LENGTH_MAX - 1];
+    t_sample downEvenHistory[OVERSAMPLER_STAGES_MAX][2 * OVERSAMPLER_LENGTH_MAX - 1];
+    t_sample downOddHistory[OVERSAMPLER_STAGES_MAX][OVERSAMPLER_LENGTH_MAX];
+};
+
+typedef struct _oversampler oversampler_t;
+
+/* Scratch space for the filters and the blocks an object processes at the oversampled rate, allocated in
+ one piece and aligned to OVERSAMPLER_ALIGNMENT. */
+struct _oversampler_buffers {
+    void *memory;
+    size_t size; /* Bytes allocated at 'memory'. */
+    int numSamples; /* Base rate block size the buffers are for. */
+    int factor;
+    int numVectors;
+    t_sample *line; /* History followed by a block of input for the FIR branch. */
+    t_sample *oddLine; /* Same for the delay branch when going down. */
+    t_sample *branch; /* Output of the FIR branch when going up. */
+    t_sample *vectors[OVERSAMPLER_VECTORS_MAX]; /* numSamples * factor samples each. */
+};
+
+typedef struct _oversampler_buffers oversampler_buffers_t;
+
+/* FIR branch coefficients of every stage, designed the first time they are needed. The branch of stage s
+ holds 2 * oversampler_lengths[s] taps and is symmetric, so only the first half is kept. They sum to 1
+ over the whole branch, which is the gain going up; going down they are halved. */
+static t_sample oversampler_coefficients[OVERSAMPLER_STAGES_MAX][OVERSAMPLER_LENGTH_MAX];
+static int oversampler_designed = 0;
+
+/* Zeroth order modified Bessel function of the first kind, for the Kaiser window. */
+static OVERSAMPLER_INLINE double
+oversampler_bessel_i0 (double x) {
+    double sum = 1.;
+    double term = 1.;
+    int k;
+    for (k = 1; k < 50 && term > 1e-12 * sum; k++) {
+        term *= (x * x) / (4. * k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+/* Designs a Kaiser-windowed sinc half-band of 4 * length - 1 taps. Every other tap of a half-band is zero
+ except the centre one, which is 1/2; the rest make up the FIR branch. */
+static OVERSAMPLER_INLINE void
+oversampler_design (t_sample* coefficients, int length, double beta) {
+    const double pi = 3.14159265358979323846;
+    int centre = 2 * length - 1;
+    double taps[OVERSAMPLER_LENGTH_MAX];
+    double sum = 0.;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        double offset = (double)(centre - 2 * i); /* Odd, so the sinc is never at a zero. */
+        double position = offset / centre;
+        double window = oversampler_bessel_i0(beta * sqrt(1. - position * position)) / oversampler_bessel_i0(beta);
+        taps[i] = sin(pi * offset / 2.) / (pi * offset) * window;
+        sum += 2. * taps[i];
+    }
+    for (i = 0; i < length; i++) {
+        coefficients[i] = (t_sample)(taps[i] / sum);
+    }
+}
+
+static OVERSAMPLER_INLINE void
+oversampler_design_all (void) {
+    int s;
+    if (oversampler_designed) {
+        return;
+    }
+    for (s = 0; s < OVERSAMPLER_STAGES_MAX; s++) {
+        oversampler_design(oversampler_coefficients[s], oversampler_lengths[s], oversampler_betas[s]);
+    }
+    oversampler_designed = 1;
+}
+
+/* Rounds a requested factor to the nearest supported one at or below it. */
+static OVERSAMPLER_INLINE int
+oversampler_factor_find (int factor) {
+    return (factor >= 8 ? 8 : (factor >= 4 ? 4 : (factor >= 2 ? 2 : 1)));
+}
+
+static OVERSAMPLER_INLINE void
+oversampler_init (oversampler_t* oversampler, int factor) {
+    oversampler_design_all();
+    memset(oversampler, 0, sizeof(oversampler_t));
+    oversampler->factor = oversampler_factor_find(factor);
+    oversampler->numStages = (oversampler->factor == 8 ? 3 : (oversampler->factor == 4 ? 2 : (oversampler->factor == 2 ? 1 : 0)));
+}
+
+/* Delay a signal picks up going up and back down, in samples at the base rate. Each half-band delays by
+ 2 * length - 1 samples at its higher rate, once up and once down. */
+static OVERSAMPLER_INLINE double
+oversampler_latency (const oversampler_t* oversampler) {
+    double latency = 0.;
+    int s;
+    for (s = 0; s < oversampler->numStages; s++) {
+        latency += 2. * (2 * oversampler_lengths[s] - 1) / (double)(2 << s);
+    }
+    return latency;
+}
+
+static OVERSAMPLER_INLINE t_sample*
+oversampler_align (char** cursor, size_t numSamples) {
+    t_sample *vector = (t_sample *)*cursor;
+    size_t bytes = numSamples * sizeof(t_sample);
+    *cursor += (bytes + OVERSAMPLER_ALIGNMENT - 1) / OVERSAMPLER_ALIGNMENT * OVERSAMPLER_ALIGNMENT;
+    return vector;
+}
+
+static OVERSAMPLER_INLINE void
+oversampler_buffers_init (oversampler_buffers_t* buffers) {
+    memset(buffers, 0, sizeof(oversampler_buffers_t));
+}
+
+static OVERSAMPLER_INLINE void
+oversampler_buffers_free (oversampler_buffers_t* buffers) {
+    if (buffers->memory) {
+        freebytes(buffers->memory, buffers->size);
+    }
+    oversampler_buffers_init(buffers);
+}
+
+/* Makes room for blocks of numSamples at the base rate and numVectors blocks at factor times that rate for
+ the object's own use. Called from the dsp method, so the perform routine never allocates. */
+static OVERSAMPLER_INLINE void
+oversampler_buffers_resize (oversampler_buffers_t* buffers, int numSamples, int factor, int numVectors) {
+    size_t half = (size_t)numSamples * (factor > 1 ? factor / 2 : 1);
+    size_t line = 2 * OVERSAMPLER_LENGTH_MAX - 1 + half;
+    size_t vector = (size_t)numSamples * factor;
+    size_t size;
+    char *cursor;
+    int v;
+
+    if (numSamples == buffers->numSamples && factor == buffers->factor && numVectors == buffers->numVectors) {
+        return;
+    }
+    oversampler_buffers_free(buffers);
+    size = OVERSAMPLER_ALIGNMENT + (3 * (line + OVERSAMPLER_ALIGNMENT) + numVectors * (vector + OVERSAMPLER_ALIGNMENT))
+        * sizeof(t_sample);
+    buffers->memory = getbytes(size);
+    buffers->size = size;
+    buffers->numSamples = numSamples;
+    buffers->factor = factor;
+    buffers->numVectors = numVectors;
+
+    cursor = (char *)buffers->memory;
+    cursor += (OVERSAMPLER_ALIGNMENT - (size_t)cursor % OVERSAMPLER_ALIGNMENT) % OVERSAMPLER_ALIGNMENT;
+    buffers->line = oversampler_align(&cursor, line);
+    buffers->oddLine = oversampler_align(&cursor, line);
+    buffers->branch = oversampler_align(&cursor, line);
+    for (v = 0; v < numVectors; v++) {
+        buffers->vectors[v] = oversampler_align(&cursor, vector);
+    }
+}
+
+/* Runs the FIR branch of a stage over the numSamples inputs that follow the history at the start of 'line',
+ accumulating into out. For tap pairs (k, 2 * length - 1 - k) the sum is
+ out[i] += c[k] * (x[i - k] + x[i - 2 * length + 1 + k]), read forwards from two points of the line. */
+static OVERSAMPLER_INLINE void
+oversampler_branch (const t_sample* coefficients, int length, const t_sample* line, t_sample* out, int numSamples,
+                    t_sample gain) {
+    int span = 2 * length - 1;
+    int i, k;
+    for (k = 0; k < length; k++) {
+        const t_sample c = coefficients[k] * gain;
+        const t_sample *early = line + k;
+        const t_sample *late = line + span - k;
+        for (i = 0; i < numSamples; i++) {
+            out[i] += c * (early[i] + late[i]);
+        }
+    }
+}
+
+/* One 2x stage up: numSamples inputs give 2 * numSamples outputs. Even outputs come from the FIR branch
+ and odd ones are the input delayed to the centre tap. 'in' may be the start of 'out'. */
+static OVERSAMPLER_INLINE void
+oversampler_up_stage (const t_sample* coefficients, int length, t_sample* history, oversampler_buffers_t* buffers,
+                      const t_sample* in, t_sample* out, int numSamples) {
+    int span = 2 * length - 1;
+    t_sample *line = buffers->line;
+    t_sample *branch = buffers->branch;
+    int i;
+
+    memcpy(line, history, span * sizeof(t_sample));
+    memcpy(line + span, in, numSamples * sizeof(t_sample));
+    memset(branch, 0, numSamples * sizeof(t_sample));
+    oversampler_branch(coefficients, length, line, branch, numSamples, 1.f);
+    for (i = 0; i < numSamples; i++) {
+        out[2 * i] = branch[i];
+        out[2 * i + 1] = line[i + length];
+    }
+    memcpy(history, line + numSamples, span * sizeof(t_sample));
+}
+
+/* One 2x stage down: 2 * numSamples inputs give numSamples outputs, the even inputs through the FIR branch
+ and the odd ones through the delay, each at half gain. 'out' may be the start of 'in'. */
+static OVERSAMPLER_INLINE void
+oversampler_down_stage (const t_sample* coefficients, int length, t_sample* evenHistory, t_sample* oddHistory,
+                        oversampler_buffers_t* buffers, const t_sample* in, t_sample* out, int numSamples) {
+    int span = 2 * length - 1;
+    t_sample *even = buffers->line;
+    t_sample *odd = buffers->oddLine;
+    int i;
+
+    memcpy(even, evenHistory, span * sizeof(t_sample));
+    memcpy(odd, oddHistory, length * sizeof(t_sample));
+    for (i = 0; i < numSamples; i++) {
+        even[span + i] = in[2 * i];
+        odd[length + i] = in[2 * i + 1];
+    }
+    for (i = 0; i < numSamples; i++) {
+        out[i] = 0.5f * odd[i];
+    }
+    oversampler_branch(coefficients, length, even, out, numSamples, 0.5f);
+    memcpy(evenHistory, even + numSamples, span * sizeof(t_sample));
+    memcpy(oddHistory, odd + numSamples, length * sizeof(t_sample));
+}
+
+/* Brings numSamples of 'in' up to numSamples * factor samples in 'out'. */
+static OVERSAMPLER_INLINE void
+oversampler_up (oversampler_t* oversampler, oversampler_buffers_t* buffers, const t_sample* in, t_sample* out,
+                int numSamples) {
+    int s;
+    if (oversampler->numStages == 0) {
+        if (in != out) {
+            memcpy(out, in, numSamples * sizeof(t_sample));
+        }
+        return;
+    }
+    for (s = 0; s < oversampler->numStages; s++) {
+        oversampler_up_stage(oversampler_coefficients[s], oversampler_lengths[s], oversampler->upHistory[s], buffers,
+                             (s == 0 ? in : out), out, numSamples << s);
+    }
+}
+
+/* Brings numSamples * factor samples of 'in' back down to numSamples in 'out'. 'in' is used as scratch
+ space on the way. */
+static OVERSAMPLER_INLINE void
+oversampler_down (oversampler_t* oversampler, oversampler_buffers_t* buffers, t_sample* in, t_sample* out,
+                  int numSamples) {
+    int s;
+    if (oversampler->numStages == 0) {
+        if (in != out) {
+            memcpy(out, in, numSamples * sizeof(t_sample));
+        }
+        return;
+    }
+    for (s = oversampler->numStages - 1; s >= 0; s--) {
+        oversampler_down_stage(oversampler_coefficients[s], oversampler_lengths[s], oversampler->downEvenHistory[s],
+                               oversampler->downOddHistory[s], buffers, in, (s == 0 ? out : in), numSamples << s);
+    }
+}
+
+/* Repeats each of numSamples control values 'factor' times, for parameters that go along with a signal
+ at the oversampled rate. 'in' may be the start of 'out'. */
+static OVERSAMPLER_INLINE void
+oversampler_hold (const t_sample* in, t_sample* out, int numSamples, int factor) {
+    int i, k;
+    for (i = numSamples - 1; i >= 0; i--) {
+        t_sample value = in[i];
+        for (k = factor - 1; k >= 0; k--) {
+            out[i * factor + k] = value;
+        }
+    }
+}
+
+#endif /* OVERSAMPLER_H */
@@ -0,0 +1,65 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  ----------------------------------------------------------------------------------------
+//
+//  Pure Data, Copyright (c) 1997-1999 Miller Puckette.
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms
+//  of the GNU General Public License as published by the Free Software Foundation, either
+//  version 3 of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+//  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//  See the  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along with this program.
+//  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/* All the externals in a single binary, loaded once at startup with 'pd -lib pd-externals' (or [declare -lib
+ pd-externals]) instead of Pd searching its paths for, and opening, a separate file for each object. The
+ externals' sources are compiled here as one translation unit, so the state they share through the headers
+ (the cached CPU features, the oversampler's filters, the kernels themselves) exists once in the library.
+ New objects are added with an #include and a call in pd_externals_setup. */
+
+#include "polyblep~.c"
+#include "foldback~.c"
+#include "blepfold~.c"
+
+void
+pd_externals_setup (void) {
+    /* One-time work the objects share, done up front: detecting the CPU that each setup below picks its
+     kernels for, and designing the oversampler's filters, which would otherwise happen when the first
+     object with -os is created. */
+    cpu_features();
+    oversampler_design_all();
+    
+    polyblep_tilde_setup();
+    foldback_tilde_setup();
+    blepfold_tilde_setup();
+}
+
+/* Pd looks up a library's setup function by its name. '-' cannot be part of a C name, so for pd-externals
+ Pd looks for the name with the character written in hex after a setup_ prefix. */
+void
+setup_pd0x2dexternals (void) {
+    pd_externals_setup();
+}
@@ -0,0 +1,273 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  PolyBLEP core, included by polyblep.h once per sample type (see dsp_core.h): the phase accumulator,
+//  the band-limited sawtooth for one sample, and the scalar kernels for the sawtooth with either phase
+//  and a constant or per-sample frequency, the 2-point and 4-point residuals, and the square, pulse and
+//  triangle.
+//
+//  No include guard: this is meant to be included more than once.
+//
+
+/* Bandlimited sawtooth at normalized phase t, with the BLEP residual written as the square of a
+ linear term so it shares its form with the vector lanes. freq is the absolute normalized frequency,
+ so a negative frequency gets the mirrored (but identical) correction. */
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_saw_sample) (DSP_T t, DSP_T freq, DSP_T invFreq) {
+    DSP_T u;
+    if (t < freq) {
+        u = t * invFreq - 1;
+        return (2 * t - 1) + u*u;
+    } else if (t > 1 - freq) {
+        u = (t - 1) * invFreq + 1;
+        return (2 * t - 1) - u*u;
+    }
+    return 2 * t - 1;
+}
+
+/* Normalized phase in [0, 1) of the integer accumulator. Single precision keeps the top 24 bits so the
+ conversion is exact and never rounds up to 1; double precision holds all 32. */
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_phase_norm) (uint32_t phase) {
+    if (sizeof(DSP_T) == sizeof(float)) {
+        return (DSP_T)(phase >> 8) * ((DSP_T)1 / 16777216);
+    }
+    return (DSP_T)phase * (DSP_T)(1. / PHASE_RANGE);
+}
+
+/* Phase increment of the integer accumulator for |normFreq| < 1. Negative frequencies wrap around to
+ large increments, which is the same thing modulo 2^32. */
+static CPU_INLINE uint32_t
+DSP_FN(polyblep_phase_incr) (DSP_T normFreq) {
+    return (uint32_t)(int64_t)(normFreq * PHASE_RANGE);
+}
+
+/* Sawtooth sample for the audio-rate frequency path, where the BLEP width changes every sample. The
+ divide is only taken for the samples inside the residual's window. */
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_saw_fm_sample) (DSP_T t, DSP_T freq) {
+    DSP_T u;
+    if (t < freq) {
+        u = t / freq - 1;
+        return (2 * t - 1) + u*u;
+    } else if (t > 1 - freq) {
+        u = (t - 1) / freq + 1;
+        return (2 * t - 1) - u*u;
+    }
+    return 2 * t - 1;
+}
+
+/* Renders the PolyBLEP sawtooth with the original per-sample algorithm, on a phase in radians. This is the
+ scalar fallback and the reference the vectorized kernels are checked against. */
+static CPU_INLINE void
+DSP_FN(polyblep_saw_scalar) (DSP_T* out, int numSamples, DSP_T* phase, DSP_T normFreq) {
+    DSP_T phaseIncr = normFreq * TWOPI;
+    
+    while (numSamples--) {
+        DSP_T t = *phase / TWOPI;
+        DSP_T sample = (2 * t) - 1; /* Calculate naive sawtooth sample. */
+        DSP_T polyblep_value;
+        
+        *phase += phaseIncr;
+        *phase = (*phase >= TWOPI ? *phase-TWOPI : *phase);
+        
+        polyblep_value = 0;
+        {
+            if (t < normFreq) {
+                t /= normFreq;
+                polyblep_value = t+t - t*t - 1;
+            } else if (t > 1 - normFreq) {
+                t = (t - 1) / normFreq;
+                polyblep_value = t*t + t+t + 1;
+            }
+        }
+        
+        *out++ = sample - polyblep_value;
+    }
+}
+
+/* Scalar kernel for the integer phase. Computing t is a shift and a multiply, and the wrap is the natural
+ overflow of the accumulator. */
+static CPU_INLINE void
+DSP_FN(polyblep_saw_int_scalar) (DSP_T* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, DSP_T normFreq) {
+    DSP_T freq = DSP_FABS(normFreq);
+    DSP_T invFreq = 1 / freq;
+    uint32_t p = *phase;
+    
+    while (numSamples--) {
+        *out++ = DSP_FN(polyblep_saw_sample)(DSP_FN(polyblep_phase_norm)(p), freq, invFreq);
+        p += phaseIncr;
+    }
+    
+    *phase = p;
+}
+
+/* Per-sample frequency kernel for the phase in radians. The phase wraps in both directions, so negative
+ (through-zero) frequencies are band-limited as well. */
+static CPU_INLINE void
+DSP_FN(polyblep_saw_fm) (DSP_T* out, const DSP_T* in, int numSamples, DSP_T* phase, DSP_T invSampleRate) {
+    DSP_T t = *phase / TWOPI;
+    
+    while (numSamples--) {
+        DSP_T normFreq = *in++ * invSampleRate;
+        *out++ = DSP_FN(polyblep_saw_fm_sample)(t, DSP_FABS(normFreq));
+        t += normFreq;
+        t -= DSP_FLOOR(t);
+    }
+    
+    *phase = t * TWOPI;
+}
+
+static CPU_INLINE void
+DSP_FN(polyblep_saw_int_fm) (DSP_T* out, const DSP_T* in, int numSamples, uint32_t* phase, DSP_T invSampleRate) {
+    uint32_t p = *phase;
+    
+    while (numSamples--) {
+        DSP_T normFreq = *in++ * invSampleRate;
+        normFreq -= (DSP_T)(int)normFreq;
+        *out++ = DSP_FN(polyblep_saw_fm_sample)(DSP_FN(polyblep_phase_norm)(p), DSP_FABS(normFreq));
+        p += DSP_FN(polyblep_phase_incr)(normFreq);
+    }
+    
+    *phase = p;
+}
+
+/* Residuals for the wider kernels. They are written in terms of x, the distance from the discontinuity in
+ samples (negative before it), and return the value subtracted from the naive sawtooth, which is twice the
+ residual of a unit step since the sawtooth drops by 2. */
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_residual_2point) (DSP_T x) {
+    DSP_T a = 1 - DSP_FABS(x);
+    return (x < 0 ? a*a : -(a*a));
+}
+
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_residual_4point) (DSP_T x) {
+    DSP_T a = DSP_FABS(x);
+    DSP_T value;
+    
+    if (a >= 1) {
+        DSP_T b = 2 - a;
+        value = (b*b) * (b*b) * ((DSP_T)1 / 12);
+    } else {
+        value = 1 - a * ((DSP_T)4 / 3) + a*a*a * ((DSP_T)2 / 3) - (a*a) * (a*a) * (DSP_T)0.25;
+    }
+    return (x < 0 ? value : -value);
+}
+
+/* The other waveforms render their shape directly from the phase with 2-point residuals, rather than
+ deriving it from sawtooths, and take the frequency per sample so one kernel serves static and modulated
+ frequencies. They share the sawtooth's phase state through the integer accumulator.
+
+ 2-point residual of a step of 2 at phase 0: subtracted where the step falls, as in polyblep_saw_fm_sample,
+ and added where it rises. */
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_blep) (DSP_T t, DSP_T freq) {
+    DSP_T u;
+    if (t < freq) {
+        u = t / freq - 1;
+        return -(u*u);
+    } else if (t > 1 - freq) {
+        u = (t - 1) / freq + 1;
+        return u*u;
+    }
+    return 0;
+}
+
+/* 2-point residual of a corner at phase 0 where the slope rises by one per sample: the integral of the
+ polyBLEP, (1 - |x|)^3 / 6 within a sample of the corner. */
+static CPU_INLINE DSP_T
+DSP_FN(polyblep_blamp) (DSP_T t, DSP_T freq) {
+    DSP_T a;
+    if (t < freq) {
+        a = 1 - t / freq;
+    } else if (t > 1 - freq) {
+        a = 1 - (1 - t) / freq;
+    } else {
+        return 0;
+    }
+    return a*a*a * ((DSP_T)1 / 6);
+}
+
+/* High for the first half of the cycle: a rising step at phase 0 and a falling one at 0.5. */
+static CPU_INLINE void
+DSP_FN(polyblep_square) (DSP_T* out, const DSP_T* in, const DSP_T* width, int numSamples, uint32_t* phase,
+                         DSP_T invSampleRate) {
+    uint32_t p = *phase;
+    
+    while (numSamples--) {
+        DSP_T normFreq = *in++ * invSampleRate;
+        DSP_T t = DSP_FN(polyblep_phase_norm)(p);
+        DSP_T freq;
+        
+        normFreq -= (DSP_T)(int)normFreq;
+        freq = DSP_FABS(normFreq);
+        *out++ = (t < (DSP_T)0.5 ? 1 : -1) + DSP_FN(polyblep_blep)(t, freq)
+            - DSP_FN(polyblep_blep)(t < (DSP_T)0.5 ? t + (DSP_T)0.5 : t - (DSP_T)0.5, freq);
+        p += DSP_FN(polyblep_phase_incr)(normFreq);
+    }
+    
+    *phase = p;
+}
+
+/* High for the fraction 'width' of the cycle. A width of 0 or 1 gives a constant -1 or 1. */
+static CPU_INLINE void
+DSP_FN(polyblep_pulse) (DSP_T* out, const DSP_T* in, const DSP_T* width, int numSamples, uint32_t* phase,
+                        DSP_T invSampleRate) {
+    uint32_t p = *phase;
+    
+    while (numSamples--) {
+        DSP_T normFreq = *in++ * invSampleRate;
+        DSP_T w = *width++;
+        DSP_T t = DSP_FN(polyblep_phase_norm)(p);
+        DSP_T fall, freq;
+        
+        normFreq -= (DSP_T)(int)normFreq;
+        freq = DSP_FABS(normFreq);
+        w = (w < 0 ? 0 : (w > 1 ? 1 : w));
+        fall = (t < w ? t - w + 1 : t - w);
+        *out++ = (t < w ? 1 : -1) + DSP_FN(polyblep_blep)(t, freq) - DSP_FN(polyblep_blep)(fall, freq);
+        p += DSP_FN(polyblep_phase_incr)(normFreq);
+    }
+    
+    *phase = p;
+}
+
+/* Rises from -1 at phase 0 to 1 at 0.5. The corners turn the slope by 8 per cycle, or 8 * freq per sample. */
+static CPU_INLINE void
+DSP_FN(polyblep_triangle) (DSP_T* out, const DSP_T* in, const DSP_T* width, int numSamples, uint32_t* phase,
+                           DSP_T invSampleRate) {
+    uint32_t p = *phase;
+    
+    while (numSamples--) {
+        DSP_T normFreq = *in++ * invSampleRate;
+        DSP_T t = DSP_FN(polyblep_phase_norm)(p);
+        DSP_T freq;
+        
+        normFreq -= (DSP_T)(int)normFreq;
+        freq = DSP_FABS(normFreq);
+        *out++ = 1 - 2 * DSP_FABS(2 * t - 1)
+            + 8 * freq * (DSP_FN(polyblep_blamp)(t, freq)
+                          - DSP_FN(polyblep_blamp)(t < (DSP_T)0.5 ? t + (DSP_T)0.5 : t - (DSP_T)0.5, freq));
+        p += DSP_FN(polyblep_phase_incr)(normFreq);
+    }
+    
+    *phase = p;
+}
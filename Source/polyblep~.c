@@ -37,41 +37,396 @@
 //
 
 #include "m_pd.h" /* Pure Data API */
+#include "budget.h"
+#include "cpu_features.h"
+#include "event_queue.h"
+#include "oversampler.h"
+#include "polyblep.h"
+#include "profiler.h"
+#include "smoother.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 
-#define TWOPI (6.2831853f)
+#define BANK_MAX_VOICES (64)
+#define BANK_LANES (8) /* Widest vector the bank kernels use, in samples. */
+#define BLEP_TABLE_WIDTH (8) /* Samples on each side of a discontinuity covered by the table residual. */
+#define BLEP_TABLE_RESOLUTION (64) /* Table points per sample. */
+#define BLEP_TABLE_SIZE (2 * BLEP_TABLE_WIDTH * BLEP_TABLE_RESOLUTION + 2)
+#define SYNC_CARRY_SIZE (16) /* Power of two holding the corrections for the samples after a sync step. */
+#define WAVETABLE_SIZE (4096) /* Samples per cycle in each mip level, plus one guard point for interpolation. */
+#define WAVETABLE_SIZE_BITS (12)
+#define WAVETABLE_LEVELS (11) /* Level m holds the first 1024 >> m harmonics. */
+#define WAVETABLE_SOURCE_SIZE (8192) /* Samples in the polyBLEP cycle the harmonics are taken from. */
+
+/* BLEP residual used by the oscillator, from cheapest to most expensive. */
+enum {
+	POLYBLEP_QUALITY_2POINT = 0, /* Quadratic polyBLEP over one sample on each side of the discontinuity. */
+	POLYBLEP_QUALITY_4POINT = 1, /* Quartic polyBLEP (integrated cubic B-spline) over two samples on each side. */
+	POLYBLEP_QUALITY_TABLE = 2, /* Integrated windowed-sinc BLEP read from a table, eight samples on each side. */
+	POLYBLEP_QUALITY_COUNT
+};
+
+/* Waveforms. Each has its own kernel, picked when the DSP chain is built. */
+enum {
+	POLYBLEP_SHAPE_SAW = 0,
+	POLYBLEP_SHAPE_SQUARE = 1,
+	POLYBLEP_SHAPE_PULSE = 2, /* Width from the width inlet, as the fraction of the cycle spent high. */
+	POLYBLEP_SHAPE_TRIANGLE = 3,
+	POLYBLEP_SHAPE_COUNT
+};
+
+static const char *polyblep_shape_names[POLYBLEP_SHAPE_COUNT] = { "saw", "square", "pulse", "triangle" };
 
 static t_class *polyblep_tilde_class;
 
+/* Unison voices of a bank-mode oscillator, kept in structure-of-arrays form so the kernels stream
+ through one array per quantity. Voices always use the integer phase accumulator. */
+struct _polyblep_bank {
+	int numVoices;
+	t_float detune; /* Spread of the voices in semitones, from the lowest to the highest. */
+	
+	uint32_t *phase;
+	t_float *ratio; /* Frequency of each voice relative to the oscillator's frequency. */
+	
+	/* Per-block values for a constant frequency: the phase increment, the absolute normalized frequency
+	 and its reciprocal, and the phase offsets across a vector of BANK_LANES samples for each voice. */
+	uint32_t *incr;
+	t_float *freq;
+	t_float *invFreq;
+	uint32_t *laneIncr;
+};
+
+typedef struct _polyblep_bank polyblep_bank_t;
+
 struct _polyblep_tilde {
 	t_object obj;
 	
 	t_float frequency;
+	t_float inletFrequency; /* What Pd fills an unconnected left inlet with (see polyblep_apply_events). */
     t_float sampleRate;
+	
+	/* Frequency floats wait here for the sample they apply at, and are then glided to by the smoother. Blocks
+	 with changes or glides read the frequency from frequencyVector, which holds a block's worth of it. */
+	event_queue_t frequencyEvents;
+	smoother_t frequencySmoother;
+	t_sample *frequencyVector;
+	int vectorSize;
 	t_float phase;
+	uint32_t phaseAcc; /* Normalized phase used instead of 'phase' when the object is created with -intphase. */
+	int intPhase;
+	int quality; /* One of the POLYBLEP_QUALITY constants. */
+	int qualityRequested; /* Quality set on the object; 'quality' is lower while the CPU budget is short. */
+	int shape; /* One of the POLYBLEP_SHAPE constants. */
+	
+	polyblep_bank_t bank; /* Unison voices, when created with -voices N (N > 1). */
+	int multichannel; /* Output the voices as a multichannel signal instead of their sum. */
+	
+	const t_sample *wavetable; /* Shared mip-mapped sawtooth when created with -wavetable, otherwise NULL. */
+	
+	/* Hard sync. The sync inlet takes the master's phase as a ramp from 0 to 1 (e.g. a phasor~), and the
+	 oscillator resets whenever it wraps. */
+	t_sample syncPrev; /* Last sample of the sync signal, to find a wrap at the start of the next block. */
+	t_float lastFreq; /* Normalized frequency of the last sample, which advanced the phase into the next block. */
+	t_float syncHold; /* Samples into the next block that still get corrections from the last sync block. */
+	t_sample syncCarry[SYNC_CARRY_SIZE]; /* Ring of corrections for the samples after the current one. */
+	int syncHead;
+	/* Only a single sawtooth computed with BLEPs resets; anything else ignores the sync inlet. */
+	
+	/* With -os N the waveform is rendered at N times the sample rate by the block's perform routine and brought
+	 back down (see polyblep_oversampled_perform). */
+	int oversampling;
+	int oversamplingRequested; /* Factor the buffers are made for; the budget may run at a lower one. */
+	int oversampled; /* Set while the perform routine runs at the higher rate. */
+	t_perfroutine oversampledPerform;
+	t_sample oversampledSyncPrev; /* Last sync input at the base rate, to interpolate the ramp from. */
+	oversampler_t oversampler;
+	oversampler_buffers_t oversamplerBuffers;
+	
+	/* Blocks processed, and how many of them were held at a frequency of 0 (see polyblep_hold). */
+	unsigned long blocksProcessed;
+	unsigned long blocksHeld;
+	
+	budget_client_t budget; /* With -adaptive, the quality follows the process-wide CPU budget (see budget.h). */
 	
 	t_inlet *phaseInlet; /* This inlet can be used to reset the phase or offset it. Value is clamped between 0 and TWOPI. */
+	t_inlet *syncInlet;
+	t_inlet *widthInlet; /* Pulse width as a signal, 0.5 until something else is sent or connected. */
 	t_outlet *signalOut; /* Outputs the PolyBLEP signal. */
+	t_outlet *statsOut; /* Block timings on 'stats', in builds with profiling. */
+	
+#ifdef PD_EXTERNALS_PROFILING
+	profiler_t profiler; /* Block timings, sent out of statsOut on 'stats'. */
+#endif
 };
 
 typedef struct _polyblep_tilde polyblep_tilde_t;
 
+static const t_sample *polyblep_wavetable_acquire (void);
+static void polyblep_wavetable_release (void);
+
+
+/* Spreads the voices evenly over 'detune' semitones around the oscillator's frequency. */
+static void
+polyblep_bank_set_detune (polyblep_bank_t* bank, t_float detune) {
+	int v;
+	bank->detune = detune;
+	for (v = 0; v < bank->numVoices; v++) {
+		t_float position = (bank->numVoices > 1 ? (t_float)v / (bank->numVoices - 1) - 0.5f : 0.f);
+		bank->ratio[v] = (t_float)pow(2., detune * position / 12.);
+	}
+}
+
+/* Starts the voices at phase + v times the golden ratio (in cycles), so they never line up. */
+static void
+polyblep_bank_set_phase (polyblep_bank_t* bank, double phase) {
+	int v;
+	for (v = 0; v < bank->numVoices; v++) {
+		double voicePhase = phase + v * 0.6180339887498949;
+		voicePhase -= floor(voicePhase);
+		bank->phase[v] = (uint32_t)(uint64_t)(voicePhase * PHASE_RANGE);
+	}
+}
+
+static void
+polyblep_bank_init (polyblep_bank_t* bank, int numVoices, t_float detune) {
+	bank->numVoices = numVoices;
+	bank->phase = (uint32_t *)getbytes(numVoices * sizeof(uint32_t));
+	bank->ratio = (t_float *)getbytes(numVoices * sizeof(t_float));
+	bank->incr = (uint32_t *)getbytes(numVoices * sizeof(uint32_t));
+	bank->freq = (t_float *)getbytes(numVoices * sizeof(t_float));
+	bank->invFreq = (t_float *)getbytes(numVoices * sizeof(t_float));
+	bank->laneIncr = (uint32_t *)getbytes(numVoices * BANK_LANES * sizeof(uint32_t));
+	polyblep_bank_set_detune(bank, detune);
+	polyblep_bank_set_phase(bank, 0.);
+}
+
+static void
+polyblep_bank_free (polyblep_bank_t* bank) {
+	if (bank->numVoices > 1) {
+		freebytes(bank->phase, bank->numVoices * sizeof(uint32_t));
+		freebytes(bank->ratio, bank->numVoices * sizeof(t_float));
+		freebytes(bank->incr, bank->numVoices * sizeof(uint32_t));
+		freebytes(bank->freq, bank->numVoices * sizeof(t_float));
+		freebytes(bank->invFreq, bank->numVoices * sizeof(t_float));
+		freebytes(bank->laneIncr, bank->numVoices * BANK_LANES * sizeof(uint32_t));
+	}
+}
+
+/* Posts the delay oversampling adds to the output. */
+void
+polyblep_latency (polyblep_tilde_t* obj) {
+	double latency = oversampler_latency(&obj->oversampler);
+	post("polyblep~: %dx oversampling, latency %g samples (%g ms)", obj->oversampling, latency,
+		 latency * 1000. / obj->sampleRate);
+}
+
+/* Posts how often the frequency-0 fast path was taken. With profiling compiled in, the block timings also go
+ out of the stats outlet, which is silent otherwise. */
+void
+polyblep_stats (polyblep_tilde_t* obj) {
+	post("polyblep~: %lu blocks, %lu held at frequency 0", obj->blocksProcessed, obj->blocksHeld);
+#ifdef PD_EXTERNALS_PROFILING
+	profiler_output(&obj->profiler, obj->statsOut);
+#endif
+}
+
+#ifdef PD_EXTERNALS_PROFILING
+void
+polyblep_trace (polyblep_tilde_t* obj, t_symbol* sym, int argc, t_atom* argv) {
+	profiler_trace_switch(&obj->profiler, argc, argv);
+}
+#endif
+
+static void
+polyblep_quality_set (polyblep_tilde_t* obj, t_floatarg arg) {
+	int quality = (int)arg;
+	obj->qualityRequested = (quality < 0 ? 0 :
+							 (quality >= POLYBLEP_QUALITY_COUNT ? POLYBLEP_QUALITY_COUNT - 1 : quality));
+	obj->quality = budget_reduce_order(obj->qualityRequested, obj->budget.level);
+}
+
+/* Only the single sawtooth has the wider residuals. The other shapes and the unison voices keep the 2-point
+ one and the wavetable has none, so a higher quality there would do nothing; say so rather than ignore it. */
+static void
+polyblep_quality_check (polyblep_tilde_t* obj) {
+	const char *ignoredBy = (obj->bank.numVoices > 1 ? "unison voices" :
+							 (obj->wavetable ? "the wavetable" :
+							  (obj->shape != POLYBLEP_SHAPE_SAW ? polyblep_shape_names[obj->shape] : NULL)));
+	if (obj->qualityRequested != POLYBLEP_QUALITY_2POINT && ignoredBy) {
+		pd_error(obj, "polyblep~: quality %d only applies to the sawtooth, not to %s", obj->qualityRequested,
+				 ignoredBy);
+	}
+}
+
+void
+polyblep_quality (polyblep_tilde_t* obj, t_floatarg arg) {
+	polyblep_quality_set(obj, arg);
+	polyblep_quality_check(obj);
+}
+
+/* Follows the quality level of the CPU budget: a lower BLEP order first, then less oversampling. A new
+ factor starts the filters over, which is heard as a short discontinuity and changes the latency. */
+static void
+polyblep_adapt (polyblep_tilde_t* obj, int level) {
+	int factor = budget_reduce_factor(obj->oversamplingRequested, level);
+	obj->quality = budget_reduce_order(obj->qualityRequested, level);
+	if (factor != obj->oversampling) {
+		obj->oversampling = factor;
+		oversampler_init(&obj->oversampler, factor);
+	}
+}
+
+void
+polyblep_adaptive (polyblep_tilde_t* obj, t_floatarg arg) {
+	budget_client_set_adaptive(&obj->budget, arg != 0.f);
+}
+
+void
+polyblep_budget (polyblep_tilde_t* obj, t_symbol* sym, int argc, t_atom* argv) {
+	budget_message(&obj->budget, argc, argv);
+}
+
+/* Index of the shape called 'name', or -1. */
+static int
+polyblep_shape_find (t_symbol* name) {
+	int i;
+	for (i = 0; i < POLYBLEP_SHAPE_COUNT; i++) {
+		if (strcmp(name->s_name, polyblep_shape_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
 
 void*
-polyblep_tilde_new (t_floatarg freq_arg, t_floatarg sr_arg) {
+polyblep_tilde_new (t_symbol* sym, int argc, t_atom* argv) {
 	polyblep_tilde_t *obj = (polyblep_tilde_t *)pd_new(polyblep_tilde_class);
-	obj->frequency = freq_arg;
-    obj->sampleRate = sr_arg;
+	int argi = 0;
+	t_float smoothTime = 0.f;
+	int smoothMode = SMOOTHER_LINEAR;
+	
+	obj->frequency = atom_getfloatarg(0, argc, argv);
+	obj->inletFrequency = obj->frequency;
+    obj->sampleRate = atom_getfloatarg(1, argc, argv);
 	obj->phase = 0.f;
-	obj->phaseInlet = floatinlet_new(&obj->obj, &obj->phase);
+	obj->phaseAcc = 0;
+	event_queue_init(&obj->frequencyEvents);
+	smoother_init(&obj->frequencySmoother, obj->frequency);
+	obj->frequencyVector = NULL;
+	obj->vectorSize = 0;
+	obj->intPhase = 0;
+	obj->quality = obj->qualityRequested = POLYBLEP_QUALITY_2POINT;
+	obj->shape = POLYBLEP_SHAPE_SAW;
+	obj->multichannel = 0;
+	obj->syncPrev = 0.f;
+	obj->lastFreq = 0.f;
+	obj->syncHold = 0.f;
+	memset(obj->syncCarry, 0, sizeof(obj->syncCarry));
+	obj->syncHead = 0;
+	obj->blocksProcessed = obj->blocksHeld = 0;
+	obj->oversampling = 1;
+	obj->oversampled = 0;
+	obj->oversampledPerform = NULL;
+	obj->oversampledSyncPrev = 0.f;
+	oversampler_buffers_init(&obj->oversamplerBuffers);
+	budget_client_init(&obj->budget, obj, (budget_adapt_t)polyblep_adapt, 0);
+	
+	/* Optional flags follow the frequency and sample rate arguments.
+	 -intphase: accumulate the phase as a 32-bit fixed-point fraction of a cycle, which wraps for free and
+	 does not drift over long running times.
+	 -voices N: render N unison voices in one object (bank mode) and output their sum.
+	 -detune S: spread of the unison voices in semitones (default 0.2).
+	 -mc: output the unison voices as a multichannel signal (Pd 0.54 and later).
+	 -quality Q: BLEP residual of the single sawtooth, 0 = 2-point (default), 1 = 4-point, 2 = table.
+	 -shape S: saw (default), square, pulse or triangle.
+	 -wavetable: read the sawtooth from mip-mapped tables shared by all instances instead of computing BLEPs.
+	 -smooth MS [lin|exp]: glide to new frequencies over MS milliseconds, linearly (default) or exponentially.
+	 -os N: render at N times the sample rate, 2, 4 or 8, and filter back down. Not available with -mc.
+	 -adaptive: lower the quality and oversampling while the process-wide CPU budget is exceeded. */
+	{
+		int numVoices = 1;
+		t_float detune = 0.2f;
+		int wavetable = 0;
+		
+		while (argi < argc && argv[argi].a_type == A_FLOAT) {
+			argi++;
+		}
+		for (; argi < argc; argi++) {
+			t_symbol *flag = atom_getsymbol(&argv[argi]);
+			if (strcmp(flag->s_name, "-intphase") == 0) {
+				obj->intPhase = 1;
+			} else if (strcmp(flag->s_name, "-voices") == 0 && argi + 1 < argc) {
+				numVoices = (int)atom_getfloat(&argv[++argi]);
+			} else if (strcmp(flag->s_name, "-detune") == 0 && argi + 1 < argc) {
+				detune = atom_getfloat(&argv[++argi]);
+			} else if (strcmp(flag->s_name, "-quality") == 0 && argi + 1 < argc) {
+				polyblep_quality_set(obj, atom_getfloat(&argv[++argi]));
+			} else if (strcmp(flag->s_name, "-shape") == 0 && argi + 1 < argc) {
+				t_symbol *name = atom_getsymbol(&argv[++argi]);
+				int shape = polyblep_shape_find(name);
+				if (shape < 0) {
+					pd_error(obj, "polyblep~: unknown shape '%s'", name->s_name);
+				} else {
+					obj->shape = shape;
+				}
+			} else if (strcmp(flag->s_name, "-smooth") == 0 && argi + 1 < argc) {
+				smoothTime = atom_getfloat(&argv[++argi]);
+				if (argi + 1 < argc && argv[argi + 1].a_type == A_SYMBOL
+					&& smoother_mode_find(argv[argi + 1].a_w.w_symbol) >= 0) {
+					smoothMode = smoother_mode_find(argv[++argi].a_w.w_symbol);
+				}
+			} else if (strcmp(flag->s_name, "-os") == 0 && argi + 1 < argc) {
+				obj->oversampling = oversampler_factor_find((int)atom_getfloat(&argv[++argi]));
+			} else if (strcmp(flag->s_name, "-wavetable") == 0) {
+				wavetable = 1;
+			} else if (strcmp(flag->s_name, "-adaptive") == 0) {
+				obj->budget.adaptive = 1;
+			} else if (strcmp(flag->s_name, "-mc") == 0) {
+#ifdef CLASS_MULTICHANNEL
+				obj->multichannel = 1;
+#else
+				pd_error(obj, "polyblep~: -mc requires a Pd version with multichannel signals");
+#endif
+			} else {
+				pd_error(obj, "polyblep~: unknown argument '%s'", flag->s_name);
+			}
+		}
+		
+		obj->wavetable = (wavetable ? polyblep_wavetable_acquire() : NULL);
+		numVoices = (numVoices < 1 ? 1 : (numVoices > BANK_MAX_VOICES ? BANK_MAX_VOICES : numVoices));
+		obj->bank.numVoices = numVoices;
+		if (numVoices > 1) {
+			polyblep_bank_init(&obj->bank, numVoices, detune);
+		} else {
+			obj->multichannel = 0;
+		}
+		polyblep_quality_check(obj);
+		if (obj->multichannel && obj->oversampling > 1) {
+			pd_error(obj, "polyblep~: -os is not available with -mc");
+			obj->oversampling = 1;
+		}
+		obj->oversamplingRequested = obj->oversampling;
+		oversampler_init(&obj->oversampler, obj->oversampling);
+	}
+	
+	obj->phaseInlet = inlet_new(&obj->obj, &obj->obj.ob_pd, &s_float, gensym("phase"));
+	obj->syncInlet = inlet_new(&obj->obj, &obj->obj.ob_pd, &s_signal, &s_signal);
+	obj->widthInlet = signalinlet_new(&obj->obj, 0.5f);
 	obj->signalOut = outlet_new(&obj->obj, &s_signal);
+	obj->statsOut = outlet_new(&obj->obj, &s_list);
+#ifdef PD_EXTERNALS_PROFILING
+	profiler_init(&obj->profiler, "polyblep~");
+#endif
     
     if (obj->sampleRate == 0.f) {
         obj->sampleRate = sys_getsr();
     }
+	smoother_configure(&obj->frequencySmoother, smoothTime, smoothMode, obj->sampleRate);
 	
 #if DEBUG
-    post("DEBUG: polyblep~ args: %f, %f", obj->frequency, obj->sampleRate);
+    post("DEBUG: polyblep~ args: %f, %f, intphase: %d", obj->frequency, obj->sampleRate, obj->intPhase);
 #endif
     
 	return (void *)obj;
@@ -80,58 +435,955 @@ polyblep_tilde_new (t_floatarg freq_arg, t_floatarg sr_arg) {
 void
 polyblep_tilde_free (polyblep_tilde_t* obj) {
 	inlet_free(obj->phaseInlet);
+	inlet_free(obj->syncInlet);
+	inlet_free(obj->widthInlet);
 	outlet_free(obj->signalOut);
+	outlet_free(obj->statsOut);
+	polyblep_bank_free(&obj->bank);
+	if (obj->wavetable) {
+		polyblep_wavetable_release();
+	}
+	if (obj->frequencyVector) {
+		freebytes(obj->frequencyVector, obj->vectorSize * sizeof(t_sample));
+	}
+	oversampler_buffers_free(&obj->oversamplerBuffers);
 }
 
+/* While DSP runs, the change is queued so it takes effect at the sample it was sent at. */
 void
 polyblep_frequency (polyblep_tilde_t* obj, t_floatarg arg) {
-	obj->frequency = arg;
+	t_float dropped;
+	if (!canvas_dspstate) {
+		obj->frequency = obj->inletFrequency = arg;
+		smoother_reset(&obj->frequencySmoother, arg);
+	} else if (event_queue_push(&obj->frequencyEvents, arg, &dropped)) {
+		obj->frequency = dropped;
+		smoother_set_target(&obj->frequencySmoother, dropped);
+	}
 }
 
-t_int*
-polyblep_perform (t_int* args) {
-	polyblep_tilde_t *obj = (polyblep_tilde_t *)args[1];
-	t_sample *out = (t_sample *)args[2];
-	int numSamples = (int)args[3];
+void
+polyblep_phase (polyblep_tilde_t* obj, t_floatarg arg) {
+	obj->phase = (arg < 0.f ? 0.f : (arg > TWOPI ? TWOPI : arg));
+	/* TWOPI itself maps to a full cycle, which the accumulator stores as 0. */
+	obj->phaseAcc = (uint32_t)(uint64_t)(obj->phase / TWOPI * PHASE_RANGE);
+	if (obj->bank.numVoices > 1) {
+		polyblep_bank_set_phase(&obj->bank, obj->phase / TWOPI);
+	}
+}
+
+void
+polyblep_detune (polyblep_tilde_t* obj, t_floatarg arg) {
+	if (obj->bank.numVoices > 1) {
+		polyblep_bank_set_detune(&obj->bank, arg);
+	}
+}
+
+/* Sets the glide time in milliseconds (0 turns it off) and, optionally, its curve: lin or exp. */
+void
+polyblep_smooth (polyblep_tilde_t* obj, t_floatarg time, t_symbol* mode) {
+	int smoothMode = (*mode->s_name ? smoother_mode_find(mode) : obj->frequencySmoother.mode);
+	if (smoothMode < 0) {
+		pd_error(obj, "polyblep~: unknown smoothing mode '%s'", mode->s_name);
+		return;
+	}
+	smoother_configure(&obj->frequencySmoother, time, smoothMode, obj->sampleRate);
+}
+
+/* The kernel is part of the DSP chain, so a new shape rebuilds it. */
+void
+polyblep_shape (polyblep_tilde_t* obj, t_symbol* name) {
+	int shape = polyblep_shape_find(name);
+	if (shape < 0) {
+		pd_error(obj, "polyblep~: unknown shape '%s'", name->s_name);
+	} else if (shape != obj->shape) {
+		obj->shape = shape;
+		polyblep_quality_check(obj);
+		canvas_update_dsp();
+	}
+}
+
+typedef void (*polyblep_kernel_t)(t_sample* out, int numSamples, t_float* phase, t_float normFreq);
+typedef void (*polyblep_int_kernel_t)(t_sample* out, int numSamples, uint32_t* phase, uint32_t phaseIncr, t_float normFreq);
+
+/* Sawtooth kernels for the running CPU, chosen in polyblep_tilde_setup from those in polyblep.h. */
+static polyblep_kernel_t polyblep_saw_kernel = DSP_PD(polyblep_saw_scalar);
+static polyblep_int_kernel_t polyblep_saw_int_kernel = DSP_PD(polyblep_saw_int_scalar);
+
+/* Whether every sample of the frequency signal has the same value, which is always the case when
+ nothing is connected to the left inlet and Pd fills it with the last float received. */
+static int
+polyblep_block_is_constant (const t_sample* in, int numSamples) {
+	t_sample first = in[0];
+	int i;
+	for (i = 1; i < numSamples; i++) {
+		if (in[i] != first) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* ------------------------------------------------------------------------------------------------------
+ Higher-order residuals. The table residual is written like the 2-point and 4-point ones in polyblep_core.h:
+ in terms of x, the distance from the discontinuity in samples (negative before it), returning the value
+ subtracted from the naive sawtooth. */
+
+static t_sample blep_table[BLEP_TABLE_SIZE];
+
+/* Integrates a Blackman-windowed sinc with its cutoff at 0.4 of the sample rate over
+ [-BLEP_TABLE_WIDTH, BLEP_TABLE_WIDTH]. The table holds the smooth band-limited step (times 2); the
+ unit step is subtracted on lookup so the interpolation never straddles the discontinuity. */
+static void
+polyblep_init_blep_table (void) {
+	const double pi = 3.14159265358979323846;
+	const double cutoff = 0.8;
+	const int numPoints = 2 * BLEP_TABLE_WIDTH * BLEP_TABLE_RESOLUTION;
+	double integral[2 * BLEP_TABLE_WIDTH * BLEP_TABLE_RESOLUTION + 1];
+	double sum = 0.;
+	int i;
 	
-    t_float normFreq = obj->frequency / obj->sampleRate;
-	t_float phaseIncr = normFreq * TWOPI;
+	integral[0] = 0.;
+	for (i = 1; i <= numPoints; i++) {
+		/* Midpoint rule over each table interval. */
+		double x = ((i - 0.5) / BLEP_TABLE_RESOLUTION) - BLEP_TABLE_WIDTH;
+		double sinc = (x == 0. ? 1. : sin(pi * cutoff * x) / (pi * cutoff * x));
+		double w = (x + BLEP_TABLE_WIDTH) / (2. * BLEP_TABLE_WIDTH);
+		double window = 0.42 - 0.5 * cos(2. * pi * w) + 0.08 * cos(4. * pi * w);
+		sum += sinc * window;
+		integral[i] = sum;
+	}
 	
-	obj->phase = (obj->phase < 0.f ? 0.f : (obj->phase > TWOPI ? TWOPI : obj->phase));
+	for (i = 0; i <= numPoints; i++) {
+		blep_table[i] = (t_sample)(2. * integral[i] / sum);
+	}
+	blep_table[numPoints + 1] = blep_table[numPoints];
+}
+
+static t_float
+polyblep_residual_table (t_float x) {
+	t_float index = (x + BLEP_TABLE_WIDTH) * BLEP_TABLE_RESOLUTION;
+	int i = (int)index;
+	t_float frac = index - (t_float)i;
+	t_float step = blep_table[i] + frac * (blep_table[i + 1] - blep_table[i]);
+	return (x < 0.f ? step : step - 2.f);
+}
+
+/* Sawtooth with a wider residual. Both neighbouring discontinuities are added since their windows can
+ overlap at high frequencies. The frequency is read per sample, which costs little next to evaluating
+ the residual, so this serves constant and modulated frequencies and both phase representations. */
+static void
+polyblep_saw_hq (t_sample* out, const t_sample* in, int numSamples, uint32_t* phase, t_float invSampleRate,
+				 int quality) {
+	t_float (*residual)(t_float) = (quality == POLYBLEP_QUALITY_TABLE ? polyblep_residual_table :
+									DSP_PD(polyblep_residual_4point));
+	t_float width = (quality == POLYBLEP_QUALITY_TABLE ? (t_float)BLEP_TABLE_WIDTH : 2.f);
+	uint32_t p = *phase;
 	
 	while (numSamples--) {
-		t_float t = obj->phase / TWOPI;
-		t_sample sample = (2.f * t) - 1.f; /* Calculate naive sawtooth sample. */
-		t_sample polyblep_value;
+		t_float normFreq = *in++ * invSampleRate;
+		t_float t = DSP_PD(polyblep_phase_norm)(p);
+		t_float freq, reach;
+		t_sample sample = 2.f * t - 1.f;
 		
-		obj->phase += phaseIncr;
-		obj->phase = (obj->phase >= TWOPI ? obj->phase-TWOPI : obj->phase);
+		normFreq -= (t_float)(int)normFreq;
+		freq = (t_float)fabs(normFreq);
+		reach = width * freq;
+		if (t < reach) {
+			t_float k;
+			for (k = t; k < reach; k += 1.f) {
+				sample -= residual(k / freq);
+			}
+		}
+		if (t > 1.f - reach) {
+			t_float k;
+			for (k = t - 1.f; k > -reach; k -= 1.f) {
+				sample -= residual(k / freq);
+			}
+		}
+		*out++ = sample;
+		p += DSP_PD(polyblep_phase_incr)(normFreq);
+	}
+	
+	*phase = p;
+}
+
+/* ------------------------------------------------------------------------------------------------------
+ Hard sync. A reset can land anywhere in the cycle, so the size of the jump is only known once it happens
+ and the residuals cannot be found from the phase alone. Instead every discontinuity, natural wrap or sync
+ reset, is found as a step at a sub-sample time and its residual is added around it: to the samples already
+ written before it, and through the carry ring to the samples after it, which may be in the next block.
+ Steps in the first samples of a block only get the correction after them, except for natural wraps whose
+ earlier half is predicted from the phase at the end of the previous block, as the other kernels do. */
+
+/* Adds the residual of a step of height 'jump' at time 'when' (in samples from the start of the block) to the
+ samples within 'width' of it. Samples before n are in out; the rest go in the carry ring unless only the
+ correction before the step is wanted. */
+static void
+polyblep_sync_step (polyblep_tilde_t* obj, t_sample* out, int n, t_float when, t_float jump, t_float width,
+					t_float (*residual)(t_float), int before) {
+	t_float scale = 0.5f * jump;
+	int j;
+	
+	/* A step right on a sample already written counts as just after it. */
+	for (j = (int)floor(when - width) + 1; j < n && (t_float)j < when; j++) {
+		if (j >= 0) {
+			out[j] += scale * residual((t_float)j - when);
+		}
+	}
+	if (!before) {
+		/* Rounding can put a wrap the accumulator has just made a hair after the sample it shows up in. */
+		when = (when > (t_float)n ? (t_float)n : when);
+		for (j = n; (t_float)j < when + width; j++) {
+			obj->syncCarry[(obj->syncHead + j - n) & (SYNC_CARRY_SIZE - 1)] += scale * residual((t_float)j - when);
+		}
+		obj->syncHold = (when + width > obj->syncHold ? when + width : obj->syncHold);
+	}
+}
+
+/* Sawtooth with hard sync and a per-sample frequency. The phase is advanced from the last sample of the
+ previous block so a sync wrap between blocks is handled like any other. */
+static void
+polyblep_saw_sync (polyblep_tilde_t* obj, t_sample* out, const t_sample* in, const t_sample* sync, int numSamples,
+				   uint32_t* phase, t_float invSampleRate) {
+	t_float (*residual)(t_float) = (obj->quality == POLYBLEP_QUALITY_TABLE ? polyblep_residual_table :
+									(obj->quality == POLYBLEP_QUALITY_4POINT ? DSP_PD(polyblep_residual_4point) :
+									 DSP_PD(polyblep_residual_2point)));
+	t_float width = (obj->quality == POLYBLEP_QUALITY_TABLE ? (t_float)BLEP_TABLE_WIDTH :
+					 (obj->quality == POLYBLEP_QUALITY_4POINT ? 2.f : 1.f));
+	t_float normFreq = obj->lastFreq;
+	t_sample syncPrev = obj->syncPrev;
+	uint32_t p = *phase - DSP_PD(polyblep_phase_incr)(normFreq);
+	int n;
+	
+	for (n = 0; n < numSamples; n++) {
+		t_sample syncIn = sync[n];
+		t_float nextFreq = in[n] * invSampleRate;
+		t_float t = DSP_PD(polyblep_phase_norm)(p);
+		t_float freq = (t_float)fabs(normFreq);
+		
+		if (syncIn < syncPrev - 0.5f) {
+			/* The master wrapped 'ago' samples before this one, going by the slope of its ramp. */
+			t_float rise = syncIn + 1.f - syncPrev;
+			t_float ago = (rise > 0.f ? syncIn / rise : 0.f);
+			t_float reached;
+			
+			ago = (ago < 0.f ? 0.f : (ago > 1.f ? 1.f : ago));
+			reached = t + normFreq * (1.f - ago);
+			if (reached >= 1.f) {
+				polyblep_sync_step(obj, out, n, (t_float)(n - 1) + (1.f - t) / freq, -2.f, width, residual, 0);
+				reached -= 1.f;
+			} else if (reached < 0.f) {
+				polyblep_sync_step(obj, out, n, (t_float)(n - 1) + t / freq, 2.f, width, residual, 0);
+				reached += 1.f;
+			}
+			/* Back to the start of the cycle, which is the bottom of the ramp, or its top when running backwards. */
+			polyblep_sync_step(obj, out, n, (t_float)n - ago, (normFreq < 0.f ? 1.f : -1.f) - (2.f * reached - 1.f),
+							   width, residual, 0);
+			p = DSP_PD(polyblep_phase_incr)(normFreq * ago);
+		} else {
+			uint32_t incr = DSP_PD(polyblep_phase_incr)(normFreq);
+			uint32_t next = p + incr;
+			if ((int32_t)incr > 0 && next < p) {
+				polyblep_sync_step(obj, out, n, (t_float)(n - 1) + (1.f - t) / freq, -2.f, width, residual, 0);
+			} else if ((int32_t)incr < 0 && next > p) {
+				polyblep_sync_step(obj, out, n, (t_float)(n - 1) + t / freq, 2.f, width, residual, 0);
+			}
+			p = next;
+		}
+		
+		out[n] = 2.f * DSP_PD(polyblep_phase_norm)(p) - 1.f + obj->syncCarry[obj->syncHead];
+		obj->syncCarry[obj->syncHead] = 0.f;
+		obj->syncHead = (obj->syncHead + 1) & (SYNC_CARRY_SIZE - 1);
 		
-		polyblep_value = 0.f;
-		{
-			if (t < normFreq) {
-				t /= normFreq;
-				polyblep_value = t+t - t*t - 1.f;
-			} else if (t > 1.f - normFreq) {
-				t = (t - 1.f) / normFreq;
-				polyblep_value = t*t + t+t + 1.f;
+		normFreq = nextFreq - (t_float)(int)nextFreq;
+		syncPrev = syncIn;
+	}
+	
+	/* The half of the next natural wrap that falls in this block, if no reset comes first. */
+	{
+		t_float t = DSP_PD(polyblep_phase_norm)(p);
+		t_float freq = (t_float)fabs(normFreq);
+		if (normFreq > 0.f && 1.f - t < width * freq) {
+			polyblep_sync_step(obj, out, numSamples, (t_float)(numSamples - 1) + (1.f - t) / freq, -2.f, width, residual, 1);
+		} else if (normFreq < 0.f && t < width * freq) {
+			polyblep_sync_step(obj, out, numSamples, (t_float)(numSamples - 1) + t / freq, 2.f, width, residual, 1);
+		}
+	}
+	
+	*phase = p + DSP_PD(polyblep_phase_incr)(normFreq);
+	obj->lastFreq = normFreq;
+	obj->syncPrev = syncPrev;
+	obj->syncHold -= (t_float)numSamples;
+}
+
+/* ------------------------------------------------------------------------------------------------------
+ Other waveforms. Their kernels (polyblep_square, polyblep_pulse and polyblep_triangle in polyblep_core.h)
+ take the frequency per sample and share the sawtooth's phase state through the integer accumulator. */
+
+typedef void (*polyblep_shape_kernel_t)(t_sample* out, const t_sample* in, const t_sample* width, int numSamples,
+										uint32_t* phase, t_float invSampleRate);
+
+/* ------------------------------------------------------------------------------------------------------
+ Wavetable mode. One cycle of the polyBLEP sawtooth is rendered at a high resolution and its harmonics are
+ taken with a DFT. Each mip level is the sum of the harmonics up to its limit, halving from one level to the
+ next, so a level is free of aliasing for every fundamental up to the sample rate over twice its harmonic
+ count. The tables only depend on harmonic counts, so one set serves every instance at any sample rate;
+ the sample rate only decides which level is read. */
+
+static struct {
+	int refCount;
+	t_sample *tables; /* WAVETABLE_LEVELS tables of WAVETABLE_SIZE + 1 samples. */
+} polyblep_wavetable;
+
+static void
+polyblep_wavetable_build (t_sample* tables) {
+	const double pi = 3.14159265358979323846;
+	const int numHarmonics = 1024;
+	double *cosTable = (double *)getbytes(WAVETABLE_SOURCE_SIZE * sizeof(double));
+	double *source = (double *)getbytes(WAVETABLE_SOURCE_SIZE * sizeof(double));
+	double *cosCoef = (double *)getbytes((numHarmonics + 1) * sizeof(double));
+	double *sinCoef = (double *)getbytes((numHarmonics + 1) * sizeof(double));
+	const int mask = WAVETABLE_SOURCE_SIZE - 1;
+	const int stride = WAVETABLE_SOURCE_SIZE / WAVETABLE_SIZE;
+	int i, h, m;
+	
+	for (i = 0; i < WAVETABLE_SOURCE_SIZE; i++) {
+		cosTable[i] = cos(2. * pi * i / WAVETABLE_SOURCE_SIZE);
+		source[i] = DSP_PD(polyblep_saw_sample)((t_float)i / WAVETABLE_SOURCE_SIZE, 1.f / WAVETABLE_SOURCE_SIZE,
+										(t_float)WAVETABLE_SOURCE_SIZE);
+	}
+	
+	/* sin(x) is read as cos(x - pi/2), a quarter of the table back. */
+	for (h = 1; h <= numHarmonics; h++) {
+		double a = 0., b = 0.;
+		for (i = 0; i < WAVETABLE_SOURCE_SIZE; i++) {
+			int k = (h * i) & mask;
+			a += source[i] * cosTable[k];
+			b += source[i] * cosTable[(k - WAVETABLE_SOURCE_SIZE / 4) & mask];
+		}
+		cosCoef[h] = 2. * a / WAVETABLE_SOURCE_SIZE;
+		sinCoef[h] = 2. * b / WAVETABLE_SOURCE_SIZE;
+	}
+	
+	for (m = 0; m < WAVETABLE_LEVELS; m++) {
+		t_sample *table = tables + m * (WAVETABLE_SIZE + 1);
+		for (i = 0; i < WAVETABLE_SIZE; i++) {
+			double sum = 0.;
+			for (h = 1; h <= (numHarmonics >> m); h++) {
+				int k = (h * i * stride) & mask;
+				sum += cosCoef[h] * cosTable[k] + sinCoef[h] * cosTable[(k - WAVETABLE_SOURCE_SIZE / 4) & mask];
 			}
+			table[i] = (t_sample)sum;
 		}
+		table[WAVETABLE_SIZE] = table[0];
+	}
+	
+	freebytes(cosTable, WAVETABLE_SOURCE_SIZE * sizeof(double));
+	freebytes(source, WAVETABLE_SOURCE_SIZE * sizeof(double));
+	freebytes(cosCoef, (numHarmonics + 1) * sizeof(double));
+	freebytes(sinCoef, (numHarmonics + 1) * sizeof(double));
+}
+
+/* Objects are created and freed on Pd's main thread, so the count needs no lock. The tables are built by the
+ first instance and freed with the last. */
+static const t_sample *
+polyblep_wavetable_acquire (void) {
+	if (polyblep_wavetable.refCount++ == 0) {
+		polyblep_wavetable.tables = (t_sample *)getbytes(WAVETABLE_LEVELS * (WAVETABLE_SIZE + 1) * sizeof(t_sample));
+		polyblep_wavetable_build(polyblep_wavetable.tables);
+	}
+	return polyblep_wavetable.tables;
+}
+
+static void
+polyblep_wavetable_release (void) {
+	if (--polyblep_wavetable.refCount == 0) {
+		freebytes(polyblep_wavetable.tables, WAVETABLE_LEVELS * (WAVETABLE_SIZE + 1) * sizeof(t_sample));
+		polyblep_wavetable.tables = NULL;
+	}
+}
+
+/* Lowest level whose harmonics all stay below Nyquist for the phase increment incr, i.e. the smallest m with
+ 2048 * freq <= 2^m. In terms of the increment that is the bit length of (|incr| - 1) >> 21. */
+static int
+polyblep_wavetable_level (uint32_t incr) {
+	uint32_t magnitude = ((int32_t)incr < 0 ? 0u - incr : incr);
+	uint32_t octaves = (magnitude - (magnitude > 0)) >> 21;
+	int level = 0;
+	while (octaves) {
+		octaves >>= 1;
+		level++;
+	}
+	return (level >= WAVETABLE_LEVELS ? WAVETABLE_LEVELS - 1 : level);
+}
+
+/* Linearly interpolated read of the level for each sample's frequency. The top bits of the accumulator index
+ the table and the rest are the fraction between two points. */
+static void
+polyblep_wavetable_read (t_sample* out, const t_sample* in, int numSamples, uint32_t* phase, t_float invSampleRate,
+						 const t_sample* tables) {
+	const uint32_t fracMask = (1u << (32 - WAVETABLE_SIZE_BITS)) - 1;
+	const t_float fracScale = 1.f / (t_float)(fracMask + 1u);
+	uint32_t p = *phase;
+	
+	while (numSamples--) {
+		t_float normFreq = *in++ * invSampleRate;
+		const t_sample *table;
+		uint32_t phaseIncr, index;
+		t_float frac;
 		
-		*out++ = sample - polyblep_value;
+		normFreq -= (t_float)(int)normFreq;
+		phaseIncr = DSP_PD(polyblep_phase_incr)(normFreq);
+		table = tables + polyblep_wavetable_level(phaseIncr) * (WAVETABLE_SIZE + 1);
+		index = p >> (32 - WAVETABLE_SIZE_BITS);
+		frac = (t_float)(p & fracMask) * fracScale;
+		*out++ = table[index] + frac * (table[index + 1] - table[index]);
+		p += phaseIncr;
+	}
+	
+	*phase = p;
+}
+
+/* With a constant frequency the level and increment are found once for the block. */
+static void
+polyblep_wavetable_read_constant (t_sample* out, int numSamples, uint32_t* phase, t_float normFreq,
+								  const t_sample* tables) {
+	const uint32_t fracMask = (1u << (32 - WAVETABLE_SIZE_BITS)) - 1;
+	const t_float fracScale = 1.f / (t_float)(fracMask + 1u);
+	uint32_t phaseIncr = DSP_PD(polyblep_phase_incr)(normFreq);
+	const t_sample *table = tables + polyblep_wavetable_level(phaseIncr) * (WAVETABLE_SIZE + 1);
+	uint32_t p = *phase;
+	
+	while (numSamples--) {
+		uint32_t index = p >> (32 - WAVETABLE_SIZE_BITS);
+		t_float frac = (t_float)(p & fracMask) * fracScale;
+		*out++ = table[index] + frac * (table[index + 1] - table[index]);
+		p += phaseIncr;
+	}
+	
+	*phase = p;
+}
+
+/* ------------------------------------------------------------------------------------------------------
+ Bank mode. With a constant frequency, the summed output is rendered a vector of samples at a time: each
+ voice's phase is advanced across the vector from the SoA arrays and its sawtooth added to an accumulator
+ that stays in registers, so the output is written once no matter how many voices there are. */
+
+static void
+polyblep_bank_prepare (polyblep_bank_t* bank, t_float normFreq) {
+	int v, k;
+	for (v = 0; v < bank->numVoices; v++) {
+		t_float voiceFreq = normFreq * bank->ratio[v];
+		voiceFreq -= (t_float)(int)voiceFreq;
+		bank->incr[v] = DSP_PD(polyblep_phase_incr)(voiceFreq);
+		bank->freq[v] = (t_float)fabs(voiceFreq);
+		bank->invFreq[v] = 1.f / bank->freq[v];
+		for (k = 0; k < BANK_LANES; k++) {
+			bank->laneIncr[v * BANK_LANES + k] = bank->incr[v] * (uint32_t)k;
+		}
+	}
+}
+
+static void
+polyblep_bank_sum_scalar (t_sample* out, int numSamples, polyblep_bank_t* bank, t_sample gain) {
+	const int numVoices = bank->numVoices;
+	int v;
+	
+	while (numSamples--) {
+		t_sample sum = 0.f;
+		for (v = 0; v < numVoices; v++) {
+			sum += DSP_PD(polyblep_saw_sample)(DSP_PD(polyblep_phase_norm)(bank->phase[v]), bank->freq[v], bank->invFreq[v]);
+			bank->phase[v] += bank->incr[v];
+		}
+		*out++ = sum * gain;
+	}
+}
+
+/* Summed output with a per-sample frequency. Each voice's increment is recomputed every sample. */
+static void
+polyblep_bank_sum_fm (t_sample* out, const t_sample* in, int numSamples, polyblep_bank_t* bank,
+					  t_float invSampleRate, t_sample gain) {
+	const int numVoices = bank->numVoices;
+	int v;
+	
+	while (numSamples--) {
+		t_float normFreq = *in++ * invSampleRate;
+		t_sample sum = 0.f;
+		for (v = 0; v < numVoices; v++) {
+			t_float voiceFreq = normFreq * bank->ratio[v];
+			voiceFreq -= (t_float)(int)voiceFreq;
+			sum += DSP_PD(polyblep_saw_fm_sample)(DSP_PD(polyblep_phase_norm)(bank->phase[v]), (t_float)fabs(voiceFreq));
+			bank->phase[v] += DSP_PD(polyblep_phase_incr)(voiceFreq);
+		}
+		*out++ = sum * gain;
+	}
+}
+
+#if PD_FLOATSIZE == 32
+
+#if defined(CPU_X86)
+
+CPU_TARGET_SSE2 static void
+polyblep_bank_sum_sse2 (t_sample* out, int numSamples, polyblep_bank_t* bank, t_sample gain) {
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 scale = _mm_set1_ps(1.f / 16777216.f);
+	const __m128 gainv = _mm_set1_ps(gain);
+	const int numVoices = bank->numVoices;
+	int v;
+	
+	for (; numSamples >= 4; numSamples -= 4, out += 4) {
+		__m128 sum = _mm_setzero_ps();
+		for (v = 0; v < numVoices; v++) {
+			__m128i pv = _mm_add_epi32(_mm_set1_epi32((int)bank->phase[v]),
+									   _mm_loadu_si128((const __m128i *)(bank->laneIncr + v * BANK_LANES)));
+			__m128 tv = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(pv, 8)), scale);
+			__m128 freq = _mm_set1_ps(bank->freq[v]);
+			sum = _mm_add_ps(sum, polyblep_saw_lanes_sse2_f(tv, freq, _mm_sub_ps(one, freq), _mm_set1_ps(bank->invFreq[v])));
+			bank->phase[v] += bank->incr[v] * 4u;
+		}
+		_mm_storeu_ps(out, _mm_mul_ps(sum, gainv));
+	}
+	
+	polyblep_bank_sum_scalar(out, numSamples, bank, gain);
+}
+
+CPU_TARGET_AVX2 static void
+polyblep_bank_sum_avx2 (t_sample* out, int numSamples, polyblep_bank_t* bank, t_sample gain) {
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 scale = _mm256_set1_ps(1.f / 16777216.f);
+	const __m256 gainv = _mm256_set1_ps(gain);
+	const int numVoices = bank->numVoices;
+	int v;
+	
+	for (; numSamples >= 8; numSamples -= 8, out += 8) {
+		__m256 sum = _mm256_setzero_ps();
+		for (v = 0; v < numVoices; v++) {
+			__m256i pv = _mm256_add_epi32(_mm256_set1_epi32((int)bank->phase[v]),
+										  _mm256_loadu_si256((const __m256i *)(bank->laneIncr + v * BANK_LANES)));
+			__m256 tv = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(pv, 8)), scale);
+			__m256 freq = _mm256_set1_ps(bank->freq[v]);
+			sum = _mm256_add_ps(sum, polyblep_saw_lanes_avx2_f(tv, freq, _mm256_sub_ps(one, freq),
+															 _mm256_set1_ps(bank->invFreq[v])));
+			bank->phase[v] += bank->incr[v] * 8u;
+		}
+		_mm256_storeu_ps(out, _mm256_mul_ps(sum, gainv));
+	}
+	
+	_mm256_zeroupper();
+	polyblep_bank_sum_scalar(out, numSamples, bank, gain);
+}
+
+#endif /* CPU_X86 */
+
+#if defined(CPU_NEON)
+
+static void
+polyblep_bank_sum_neon (t_sample* out, int numSamples, polyblep_bank_t* bank, t_sample gain) {
+	const float32x4_t one = vdupq_n_f32(1.f);
+	const int numVoices = bank->numVoices;
+	int v;
+	
+	for (; numSamples >= 4; numSamples -= 4, out += 4) {
+		float32x4_t sum = vdupq_n_f32(0.f);
+		for (v = 0; v < numVoices; v++) {
+			uint32x4_t pv = vaddq_u32(vdupq_n_u32(bank->phase[v]), vld1q_u32(bank->laneIncr + v * BANK_LANES));
+			float32x4_t tv = vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(pv, 8)), 1.f / 16777216.f);
+			float32x4_t freq = vdupq_n_f32(bank->freq[v]);
+			sum = vaddq_f32(sum, polyblep_saw_lanes_neon_f(tv, freq, vsubq_f32(one, freq), vdupq_n_f32(bank->invFreq[v])));
+			bank->phase[v] += bank->incr[v] * 4u;
+		}
+		vst1q_f32(out, vmulq_n_f32(sum, gain));
+	}
+	
+	polyblep_bank_sum_scalar(out, numSamples, bank, gain);
+}
+
+#endif /* CPU_NEON */
+
+#endif /* PD_FLOATSIZE == 32 */
+
+typedef void (*polyblep_bank_kernel_t)(t_sample* out, int numSamples, polyblep_bank_t* bank, t_sample gain);
+
+static polyblep_bank_kernel_t polyblep_bank_sum_kernel = polyblep_bank_sum_scalar;
+
+static void
+polyblep_bank_perform (polyblep_tilde_t* obj, const t_sample* in, t_sample* out, int numSamples) {
+	polyblep_bank_t *bank = &obj->bank;
+	t_float invSampleRate = 1.f / obj->sampleRate;
+	/* Detuned voices add up in power rather than amplitude, so this keeps the level of a single voice. */
+	t_sample gain = (t_sample)(1. / sqrt((double)bank->numVoices));
+	int constant = polyblep_block_is_constant(in, numSamples);
+	
+	if (constant) {
+		polyblep_bank_prepare(bank, in[0] * invSampleRate);
+	}
+	
+#ifdef CLASS_MULTICHANNEL
+	if (obj->multichannel) {
+		/* One channel per voice. Voice 0 goes last since its channel may share memory with the input. */
+		int v;
+		for (v = bank->numVoices - 1; v >= 0; v--) {
+			if (constant) {
+				t_float voiceFreq = in[0] * invSampleRate * bank->ratio[v];
+				voiceFreq -= (t_float)(int)voiceFreq;
+				polyblep_saw_int_kernel(out + v * numSamples, numSamples, &bank->phase[v], bank->incr[v], voiceFreq);
+			} else {
+				DSP_PD(polyblep_saw_int_fm)(out + v * numSamples, in, numSamples, &bank->phase[v],
+											invSampleRate * bank->ratio[v]);
+			}
+		}
+		return;
+	}
+#endif
+	
+	if (constant) {
+		polyblep_bank_sum_kernel(out, numSamples, bank, gain);
+	} else {
+		polyblep_bank_sum_fm(out, in, numSamples, bank, invSampleRate, gain);
+	}
+}
+
+/* Applies the queued frequency changes and glides. Floats are kept apart from the inlet's signal: Pd fills an
+ unconnected left inlet with inletFrequency, which takes on a new frequency only once its change (and glide)
+ has played out. Until then the kernels read a copy of the block in which each change starts at its sample,
+ smoothed if a glide time is set, in place of the inlet. Settled blocks skip all of this. Pd cannot tell an
+ object whether an inlet is connected, so floats sent to a connected one also take over, but only until
+ their change has played out. */
+static t_sample*
+polyblep_apply_events (polyblep_tilde_t* obj, t_sample* in, int numSamples) {
+	event_queue_t *queue = &obj->frequencyEvents;
+	smoother_t *smoother = &obj->frequencySmoother;
+	int position = 0;
+	int offset;
+	
+	/* When oversampling, the changes were applied at the base rate before the block was brought up. */
+	if (obj->oversampled || (queue->count == 0 && smoother_settled(smoother))) {
+		return in;
+	}
+	if (numSamples > obj->vectorSize) {
+		while (queue->count > 0) {
+			obj->frequency = event_queue_pop(queue);
+		}
+		smoother_reset(smoother, obj->frequency);
+		obj->inletFrequency = obj->frequency;
+		return in;
+	}
+	
+	while ((offset = event_queue_next(queue, numSamples)) < numSamples) {
+		smoother_fill(smoother, obj->frequencyVector + position, offset - position);
+		position = offset;
+		obj->frequency = event_queue_pop(queue);
+		smoother_set_target(smoother, obj->frequency);
+	}
+	smoother_fill(smoother, obj->frequencyVector + position, numSamples - position);
+	if (queue->count == 0 && smoother_settled(smoother)) {
+		obj->inletFrequency = obj->frequency;
+	}
+	return obj->frequencyVector;
+}
+
+/* At a frequency of 0 the phase stands still and every sample of the block is the same. This computes the
+ first one with the block's perform routine and repeats it. 'args' are those of the perform routine: the
+ object, the frequency, a second input that has to be constant too (the sync input if 'sync' is set, where
+ it also must not have wrapped, or the width), the output and the block size. Returns 1 if the block was
+ handled, in which case the routine need not run. */
+static int
+polyblep_hold (t_int* args, t_perfroutine perform, int sync) {
+	polyblep_tilde_t *obj = (polyblep_tilde_t *)args[1];
+	const t_sample *in = (const t_sample *)args[2];
+	const t_sample *other = (const t_sample *)args[3];
+	t_sample *out = (t_sample *)args[4];
+	int numSamples = (int)args[5];
+	t_int single[6];
+	int i;
+	
+	obj->blocksProcessed++;
+	if (numSamples < 2 || in[0] != 0.f || obj->multichannel || obj->syncHold > 0.f
+		|| obj->frequencyEvents.count > 0 || !smoother_settled(&obj->frequencySmoother)
+		|| (sync && other[0] != obj->syncPrev)
+		|| !polyblep_block_is_constant(in, numSamples) || !polyblep_block_is_constant(other, numSamples)) {
+		return 0;
+	}
+	
+	memcpy(single, args, sizeof(single));
+	single[5] = 1;
+	perform(single);
+	obj->blocksProcessed--; /* The single sample is part of this block. */
+	for (i = 1; i < numSamples; i++) {
+		out[i] = out[0];
+	}
+	obj->blocksHeld++;
+	return 1;
+}
+
+t_int*
+polyblep_perform (t_int* args) {
+	polyblep_tilde_t *obj = (polyblep_tilde_t *)args[1];
+	t_sample *in = (t_sample *)args[2];
+	t_sample *sync = (t_sample *)args[3];
+	t_sample *out = (t_sample *)args[4];
+	int numSamples = (int)args[5];
+	
+    t_float normFreq;
+	
+	if (polyblep_hold(args, polyblep_perform, 1)) {
+		return (args + 6);
+	}
+	in = polyblep_apply_events(obj, in, numSamples);
+	
+	if (obj->bank.numVoices > 1) {
+		polyblep_bank_perform(obj, in, out, numSamples);
+		return (args + 6);
+	}
+	
+	/* Anything driving the sync inlet makes it change from sample to sample; an unconnected inlet never does.
+	 The sync kernel keeps running until the corrections of its last steps have been output. */
+	if (obj->syncHold > 0.f || sync[0] != obj->syncPrev || !polyblep_block_is_constant(sync, numSamples)) {
+		uint32_t phase = obj->phaseAcc;
+		if (!obj->intPhase) {
+			obj->phase = (obj->phase < 0.f ? 0.f : (obj->phase > TWOPI ? TWOPI : obj->phase));
+			phase = (uint32_t)(uint64_t)(obj->phase / TWOPI * PHASE_RANGE);
+		}
+		polyblep_saw_sync(obj, out, in, sync, numSamples, &phase, 1.f / obj->sampleRate);
+		obj->phaseAcc = phase;
+		obj->phase = DSP_PD(polyblep_phase_norm)(phase) * TWOPI;
+		return (args + 6);
+	}
+	
+	/* The other kernels advance the phase into the next block with the frequency of the last sample, which
+	 the sync kernel needs to step back to it. Both inputs may share memory with the output. */
+	normFreq = in[numSamples - 1] / obj->sampleRate;
+	obj->lastFreq = normFreq - (t_float)(int)normFreq;
+	obj->syncPrev = sync[numSamples - 1];
+	
+	if (obj->quality != POLYBLEP_QUALITY_2POINT) {
+		/* The float phase is carried through the accumulator for the block, which is lossless at this precision. */
+		uint32_t phase = obj->phaseAcc;
+		if (!obj->intPhase) {
+			obj->phase = (obj->phase < 0.f ? 0.f : (obj->phase > TWOPI ? TWOPI : obj->phase));
+			phase = (uint32_t)(uint64_t)(obj->phase / TWOPI * PHASE_RANGE);
+		}
+		polyblep_saw_hq(out, in, numSamples, &phase, 1.f / obj->sampleRate, obj->quality);
+		obj->phaseAcc = phase;
+		obj->phase = DSP_PD(polyblep_phase_norm)(phase) * TWOPI;
+		return (args + 6);
+	}
+	
+	/* A modulated frequency takes the per-sample path. Static voices stay on the constant-frequency
+	 kernels and only pay for the compare pass. */
+	if (!polyblep_block_is_constant(in, numSamples)) {
+		if (obj->intPhase) {
+			DSP_PD(polyblep_saw_int_fm)(out, in, numSamples, &obj->phaseAcc, 1.f / obj->sampleRate);
+		} else {
+			DSP_PD(polyblep_saw_fm)(out, in, numSamples, &obj->phase, 1.f / obj->sampleRate);
+		}
+		return (args + 6);
+	}
+	
+	normFreq = in[0] / obj->sampleRate;
+	
+	if (obj->intPhase) {
+		/* Frequencies beyond the sample rate alias back into (-sr, sr), like they would for the accumulator. */
+		normFreq -= (t_float)(int)normFreq;
+		polyblep_saw_int_kernel(out, numSamples, &obj->phaseAcc, DSP_PD(polyblep_phase_incr)(normFreq), normFreq);
+		return (args + 6);
+	}
+	
+	obj->phase = (obj->phase < 0.f ? 0.f : (obj->phase > TWOPI ? TWOPI : obj->phase));
+	
+	/* The vectorized kernels wrap the phase once per vector, so they are only used for 0 < f < sr. Negative
+	 and out-of-range frequencies keep the reference behaviour. */
+	if (normFreq > 0.f && normFreq < 1.f) {
+		polyblep_saw_kernel(out, numSamples, &obj->phase, normFreq);
+	} else {
+		DSP_PD(polyblep_saw_scalar)(out, numSamples, &obj->phase, normFreq);
 	}
 	
 	/* Return requirement from documentation specifies that the function must return a pointer
 	 to the memory directly behind the arguments list (in this case, the number of pointer 
-	 arguments given (3) plus 1. */
-	return (args + 4);
+	 arguments given (5) plus 1. */
+	return (args + 6);
+}
+
+/* Renders one of the other waveforms through the integer accumulator, converting the float phase in and out
+ as the higher quality sawtooth does. */
+static void
+polyblep_shape_perform (polyblep_tilde_t* obj, polyblep_shape_kernel_t kernel, t_sample* in,
+						const t_sample* width, t_sample* out, int numSamples) {
+	uint32_t phase = obj->phaseAcc;
+	in = polyblep_apply_events(obj, in, numSamples);
+	if (!obj->intPhase) {
+		obj->phase = (obj->phase < 0.f ? 0.f : (obj->phase > TWOPI ? TWOPI : obj->phase));
+		phase = (uint32_t)(uint64_t)(obj->phase / TWOPI * PHASE_RANGE);
+	}
+	kernel(out, in, width, numSamples, &phase, 1.f / obj->sampleRate);
+	obj->phaseAcc = phase;
+	obj->phase = DSP_PD(polyblep_phase_norm)(phase) * TWOPI;
+}
+
+t_int*
+polyblep_wavetable_perform (t_int* args) {
+	polyblep_tilde_t *obj = (polyblep_tilde_t *)args[1];
+	t_sample *in = (t_sample *)args[2];
+	t_sample *out = (t_sample *)args[4];
+	int numSamples = (int)args[5];
+	uint32_t phase;
+	
+	if (polyblep_hold(args, polyblep_wavetable_perform, 0)) {
+		return (args + 6);
+	}
+	in = polyblep_apply_events(obj, in, numSamples);
+	phase = obj->phaseAcc;
+	if (!obj->intPhase) {
+		obj->phase = (obj->phase < 0.f ? 0.f : (obj->phase > TWOPI ? TWOPI : obj->phase));
+		phase = (uint32_t)(uint64_t)(obj->phase / TWOPI * PHASE_RANGE);
+	}
+	if (polyblep_block_is_constant(in, numSamples)) {
+		t_float normFreq = in[0] / obj->sampleRate;
+		polyblep_wavetable_read_constant(out, numSamples, &phase, normFreq - (t_float)(int)normFreq, obj->wavetable);
+	} else {
+		polyblep_wavetable_read(out, in, numSamples, &phase, 1.f / obj->sampleRate, obj->wavetable);
+	}
+	obj->phaseAcc = phase;
+	obj->phase = DSP_PD(polyblep_phase_norm)(phase) * TWOPI;
+	return (args + 6);
+}
+
+t_int*
+polyblep_square_perform (t_int* args) {
+	if (!polyblep_hold(args, polyblep_square_perform, 0)) {
+		polyblep_shape_perform((polyblep_tilde_t *)args[1], DSP_PD(polyblep_square), (t_sample *)args[2],
+							   (t_sample *)args[3], (t_sample *)args[4], (int)args[5]);
+	}
+	return (args + 6);
+}
+
+t_int*
+polyblep_pulse_perform (t_int* args) {
+	if (!polyblep_hold(args, polyblep_pulse_perform, 0)) {
+		polyblep_shape_perform((polyblep_tilde_t *)args[1], DSP_PD(polyblep_pulse), (t_sample *)args[2],
+							   (t_sample *)args[3], (t_sample *)args[4], (int)args[5]);
+	}
+	return (args + 6);
+}
+
+t_int*
+polyblep_triangle_perform (t_int* args) {
+	if (!polyblep_hold(args, polyblep_triangle_perform, 0)) {
+		polyblep_shape_perform((polyblep_tilde_t *)args[1], DSP_PD(polyblep_triangle), (t_sample *)args[2],
+							   (t_sample *)args[3], (t_sample *)args[4], (int)args[5]);
+	}
+	return (args + 6);
+}
+
+/* Brings the sync ramp up to the oversampled rate by linear interpolation, across its wraps as well, so the
+ sync kernel still finds where in between two samples the master wrapped. */
+static void
+polyblep_sync_upsample (polyblep_tilde_t* obj, const t_sample* sync, t_sample* out, int numSamples, int factor) {
+	t_sample prev = obj->oversampledSyncPrev;
+	int i, k;
+	for (i = 0; i < numSamples; i++) {
+		t_sample next = (sync[i] < prev - 0.5f ? sync[i] + 1.f : sync[i]);
+		for (k = 1; k <= factor; k++) {
+			t_sample value = prev + (next - prev) * (t_sample)k / (t_sample)factor;
+			out[i * factor + k - 1] = (value >= 1.f ? value - 1.f : value);
+		}
+		prev = sync[i];
+	}
+	obj->oversampledSyncPrev = prev;
+}
+
+/* Runs the block's perform routine at 'oversampling' times the sample rate. Frequency changes are applied
+ first, at the base rate, and the frequency and width are held for the samples they cover; the sync ramp is
+ interpolated. The output is filtered back down to the base rate. Arguments are those of the perform
+ routine. */
+t_int*
+polyblep_oversampled_perform (t_int* args) {
+	polyblep_tilde_t *obj = (polyblep_tilde_t *)args[1];
+	t_sample *in = (t_sample *)args[2];
+	t_sample *other = (t_sample *)args[3];
+	t_sample *out = (t_sample *)args[4];
+	int numSamples = (int)args[5];
+	oversampler_buffers_t *buffers = &obj->oversamplerBuffers;
+	int factor = obj->oversampling;
+	t_float sampleRate = obj->sampleRate;
+	t_int oversampledArgs[6];
+	
+	/* The CPU budget has taken the oversampling away for now (see polyblep_adapt). */
+	if (factor == 1) {
+		return obj->oversampledPerform(args);
+	}
+	in = polyblep_apply_events(obj, in, numSamples);
+	oversampler_hold(in, buffers->vectors[0], numSamples, factor);
+	if (obj->oversampledPerform == polyblep_perform) {
+		polyblep_sync_upsample(obj, other, buffers->vectors[1], numSamples, factor);
+	} else {
+		oversampler_hold(other, buffers->vectors[1], numSamples, factor);
+	}
+	
+	oversampledArgs[0] = 0;
+	oversampledArgs[1] = (t_int)obj;
+	oversampledArgs[2] = (t_int)buffers->vectors[0];
+	oversampledArgs[3] = (t_int)buffers->vectors[1];
+	oversampledArgs[4] = (t_int)buffers->vectors[2];
+	oversampledArgs[5] = (t_int)(numSamples * factor);
+	obj->sampleRate = sampleRate * factor;
+	obj->oversampled = 1;
+	obj->oversampledPerform(oversampledArgs);
+	obj->oversampled = 0;
+	obj->sampleRate = sampleRate;
+	
+	oversampler_down(&obj->oversampler, buffers, buffers->vectors[2], out, numSamples);
+	return (args + 6);
 }
 
 void
 polyblep_dsp (polyblep_tilde_t* obj, t_signal** sp) {
-	/* Signal pointer (sp) goes clockwise from the left inlet around to the left outlet,
-	 but since there are no signal inlets, the output is at sp[0]. */
-	dsp_add(polyblep_perform, 3, obj, sp[0]->s_vec, sp[0]->s_n);
+	/* Signal pointer (sp) goes clockwise from the left inlet around to the left outlet.
+	 The first (0) is the frequency inlet, then (1) the sync inlet and (2) the width inlet, and the last (3)
+	 is the signal outlet. */
+	t_perfroutine perform;
+	t_sample *other; /* The sync input for the sawtooth, or the width for the other shapes. */
+	
+	if (sp[0]->s_n > obj->vectorSize) {
+		obj->frequencyVector = (t_sample *)resizebytes(obj->frequencyVector, obj->vectorSize * sizeof(t_sample),
+													   sp[0]->s_n * sizeof(t_sample));
+		obj->vectorSize = sp[0]->s_n;
+	}
+	event_queue_dsp(&obj->frequencyEvents, sp[0]->s_n, sp[0]->s_sr);
+	
+#ifdef CLASS_MULTICHANNEL
+	signal_setmultiout(&sp[3], obj->multichannel ? obj->bank.numVoices : 1);
+#endif
+	/* Unison voices are sawtooths; the shape applies to a single oscillator. */
+	if (obj->bank.numVoices > 1 || (obj->shape == POLYBLEP_SHAPE_SAW && !obj->wavetable)) {
+		perform = polyblep_perform;
+		other = sp[1]->s_vec;
+	} else {
+		switch (obj->shape) {
+			case POLYBLEP_SHAPE_SAW: perform = polyblep_wavetable_perform; break;
+			case POLYBLEP_SHAPE_SQUARE: perform = polyblep_square_perform; break;
+			case POLYBLEP_SHAPE_PULSE: perform = polyblep_pulse_perform; break;
+			default: perform = polyblep_triangle_perform; break;
+		}
+		other = sp[2]->s_vec;
+	}
+	
+	if (obj->oversamplingRequested > 1) {
+		oversampler_buffers_resize(&obj->oversamplerBuffers, sp[0]->s_n, obj->oversamplingRequested, 3);
+		obj->oversampledPerform = perform;
+		perform = polyblep_oversampled_perform;
+	}
+#ifdef PD_EXTERNALS_PROFILING
+	profiler_dsp_begin(&obj->profiler);
+#endif
+	budget_dsp_begin(&obj->budget);
+	dsp_add(perform, 5, obj, sp[0]->s_vec, other, sp[3]->s_vec, sp[0]->s_n);
+	budget_dsp_end(&obj->budget);
+#ifdef PD_EXTERNALS_PROFILING
+	profiler_dsp_end(&obj->profiler);
+#endif
 }
 
 void
@@ -139,10 +1391,53 @@ polyblep_tilde_setup (void) {
 	polyblep_tilde_class = class_new(gensym("polyblep~"),
 									 (t_newmethod)polyblep_tilde_new,
 									 (t_method)polyblep_tilde_free,
-									 sizeof(polyblep_tilde_t), CLASS_DEFAULT,
-                                     A_DEFFLOAT, A_DEFFLOAT, 0);
+									 sizeof(polyblep_tilde_t),
+#ifdef CLASS_MULTICHANNEL
+									 CLASS_DEFAULT | CLASS_MULTICHANNEL,
+#else
+									 CLASS_DEFAULT,
+#endif
+                                     A_GIMME, 0);
 	
 	class_addmethod(polyblep_tilde_class, (t_method)polyblep_dsp, gensym("dsp"), 0);
-	/* Float messages to the left inlet modifies the waveform's frequency. */
+	/* Float messages to the right inlet arrive as 'phase'. */
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_phase, gensym("phase"), A_FLOAT, 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_detune, gensym("detune"), A_FLOAT, 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_quality, gensym("quality"), A_FLOAT, 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_shape, gensym("shape"), A_SYMBOL, 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_smooth, gensym("smooth"), A_FLOAT, A_DEFSYM, 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_stats, gensym("stats"), 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_latency, gensym("latency"), 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_adaptive, gensym("adaptive"), A_FLOAT, 0);
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_budget, gensym("budget"), A_GIMME, 0);
+#ifdef PD_EXTERNALS_PROFILING
+	class_addmethod(polyblep_tilde_class, (t_method)polyblep_trace, gensym("trace"), A_GIMME, 0);
+#endif
+	
+	polyblep_init_blep_table();
+	/* The left inlet takes the frequency as a signal. Floats sent to it go to polyblep_frequency instead of
+	 straight to the inlet's scalar value; it is added after CLASS_MAINSIGNALIN so it replaces Pd's default
+	 handler. */
+	CLASS_MAINSIGNALIN(polyblep_tilde_class, polyblep_tilde_t, inletFrequency);
 	class_addfloat(polyblep_tilde_class, (t_method)polyblep_frequency);
+	
+#if PD_FLOATSIZE == 32
+# if defined(CPU_X86)
+	if (cpu_features() & CPU_FEATURE_AVX2) {
+		polyblep_saw_kernel = polyblep_saw_avx2_f;
+		polyblep_saw_int_kernel = polyblep_saw_int_avx2_f;
+		polyblep_bank_sum_kernel = polyblep_bank_sum_avx2;
+	} else if (cpu_features() & CPU_FEATURE_SSE2) {
+		polyblep_saw_kernel = polyblep_saw_sse2_f;
+		polyblep_saw_int_kernel = polyblep_saw_int_sse2_f;
+		polyblep_bank_sum_kernel = polyblep_bank_sum_sse2;
+	}
+# elif defined(CPU_NEON)
+	if (cpu_features() & CPU_FEATURE_NEON) {
+		polyblep_saw_kernel = polyblep_saw_neon_f;
+		polyblep_saw_int_kernel = polyblep_saw_int_neon_f;
+		polyblep_bank_sum_kernel = polyblep_bank_sum_neon;
+	}
+# endif
+#endif
 }
@@ -0,0 +1,313 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Optional timing of the externals' DSP, compiled in with PD_EXTERNALS_PROFILING. An object's
+//  perform routines are put between profiler_begin and profiler_end in the DSP chain, which time
+//  each block and keep the object's statistics: the min, average and max ns per block since DSP
+//  was started and the 99th percentile over the most recent blocks. While a trace is running,
+//  every timed block is also recorded as an event for the Chrome trace viewer (chrome://tracing
+//  or Perfetto), and the JSON file is written when the trace is stopped.
+//
+//  The statistics belong to the object and are only touched by its perform routines and message
+//  handlers, which Pd never runs at the same time, so nothing is locked. Without
+//  PD_EXTERNALS_PROFILING only the clock below is defined, and the objects have no profiler or
+//  chain entries, so the DSP is exactly what it is without this header. The objects' stats outlet
+//  is there either way, so patches connect the same in both builds; without profiling nothing
+//  comes out of it.
+//
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "m_pd.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+# define PROFILER_INLINE __inline
+#else
+# define PROFILER_INLINE inline
+#endif
+
+/* Monotonic time in nanoseconds, from an arbitrary start. */
+static PROFILER_INLINE double
+profiler_now_ns (void) {
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+#ifdef PD_EXTERNALS_PROFILING
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILER_RECENT (1024) /* Blocks the percentile is taken over. */
+#define PROFILER_TRACE_EVENTS (1 << 18) /* Blocks one trace keeps; any after that are only counted. */
+#define PROFILER_TRACE_NAME "pd-externals-trace"
+#define PROFILER_TRACE_VERSION (1)
+
+/* One timed block of one object. */
+struct _profiler_event {
+    double start; /* On the clock of profiler_now_ns. */
+    float duration; /* In nanoseconds. */
+    int id;
+    t_symbol *name;
+};
+
+typedef struct _profiler_event profiler_event_t;
+
+/* The trace is shared by every object in the process. Unless the externals are built as the single
+ library, each one is its own binary with its own copy of this header, so the first to need the trace
+ creates it and binds it to PROFILER_TRACE_NAME, where the others find it. The version guards against a
+ binary built from an older layout of the struct. */
+struct _profiler_trace {
+    t_pd pd;
+    int version;
+    int numIds; /* Instance numbers handed out so far. */
+    int running;
+    char path[MAXPDSTRING];
+    double start;
+    profiler_event_t *events; /* PROFILER_TRACE_EVENTS of them while running, otherwise NULL. */
+    long numEvents;
+    long numDropped;
+};
+
+typedef struct _profiler_trace profiler_trace_t;
+
+struct _profiler {
+    t_symbol *name; /* Class of the object, for the trace. */
+    int id; /* Instance number in the process, for the trace. */
+    profiler_trace_t *trace;
+    t_glist *canvas; /* Relative trace paths are taken from the object's patch directory. */
+    
+    double start; /* When the block being timed started. */
+    unsigned long numBlocks;
+    double totalNs;
+    double minNs;
+    double maxNs;
+    float recentNs[PROFILER_RECENT]; /* Ring of the latest block times, at numBlocks % PROFILER_RECENT. */
+};
+
+typedef struct _profiler profiler_t;
+
+static profiler_trace_t*
+profiler_trace_get (void) {
+    static profiler_trace_t *trace = NULL;
+    t_symbol *sym;
+    
+    if (trace) {
+        return trace;
+    }
+    sym = gensym(PROFILER_TRACE_NAME);
+    if (sym->s_thing && strcmp(class_getname(*sym->s_thing), PROFILER_TRACE_NAME) == 0
+        && ((profiler_trace_t *)sym->s_thing)->version == PROFILER_TRACE_VERSION) {
+        trace = (profiler_trace_t *)sym->s_thing;
+    } else {
+        /* Without a new method the class cannot be created from a patch; it only holds the trace. */
+        t_class *traceClass = class_new(sym, 0, 0, sizeof(profiler_trace_t), CLASS_PD, 0);
+        trace = (profiler_trace_t *)pd_new(traceClass);
+        trace->version = PROFILER_TRACE_VERSION;
+        trace->numIds = 0;
+        trace->running = 0;
+        trace->path[0] = 0;
+        trace->events = NULL;
+        trace->numEvents = trace->numDropped = 0;
+        pd_bind(&trace->pd, sym);
+    }
+    return trace;
+}
+
+static void
+profiler_reset (profiler_t* profiler) {
+    profiler->numBlocks = 0;
+    profiler->totalNs = 0.;
+    profiler->minNs = 0.;
+    profiler->maxNs = 0.;
+}
+
+/* Sets up the profiler of an object of class 'name'. */
+static void
+profiler_init (profiler_t* profiler, const char* name) {
+    profiler->name = gensym(name);
+    profiler->trace = profiler_trace_get();
+    profiler->id = ++profiler->trace->numIds;
+    profiler->canvas = canvas_getcurrent();
+    profiler->start = 0.;
+    profiler_reset(profiler);
+}
+
+static t_int*
+profiler_begin (t_int* args) {
+    profiler_t *profiler = (profiler_t *)args[1];
+    profiler->start = profiler_now_ns();
+    return args + 2;
+}
+
+static t_int*
+profiler_end (t_int* args) {
+    profiler_t *profiler = (profiler_t *)args[1];
+    profiler_trace_t *trace = profiler->trace;
+    double elapsed = profiler_now_ns() - profiler->start;
+    
+    if (profiler->numBlocks == 0 || elapsed < profiler->minNs) {
+        profiler->minNs = elapsed;
+    }
+    if (elapsed > profiler->maxNs) {
+        profiler->maxNs = elapsed;
+    }
+    profiler->totalNs += elapsed;
+    profiler->recentNs[profiler->numBlocks % PROFILER_RECENT] = (float)elapsed;
+    profiler->numBlocks++;
+    
+    if (trace->running) {
+        if (trace->numEvents < PROFILER_TRACE_EVENTS) {
+            profiler_event_t *event = &trace->events[trace->numEvents++];
+            event->start = profiler->start;
+            event->duration = (float)elapsed;
+            event->id = profiler->id;
+            event->name = profiler->name;
+        } else {
+            trace->numDropped++;
+        }
+    }
+    return args + 2;
+}
+
+/* Puts the object's perform routines, added between these two calls in its dsp method, between the timing
+ routines. The statistics start over, since a new chain may run at another block size. */
+static void
+profiler_dsp_begin (profiler_t* profiler) {
+    profiler_reset(profiler);
+    dsp_add(profiler_begin, 1, profiler);
+}
+
+static void
+profiler_dsp_end (profiler_t* profiler) {
+    dsp_add(profiler_end, 1, profiler);
+}
+
+static int
+profiler_compare_floats (const void* a, const void* b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* Sends 'min avg max p99' in ns per block out of 'outlet'. Nothing is sent before the first block. */
+static void
+profiler_output (profiler_t* profiler, t_outlet* outlet) {
+    float sorted[PROFILER_RECENT];
+    int numRecent = (profiler->numBlocks < PROFILER_RECENT ? (int)profiler->numBlocks : PROFILER_RECENT);
+    int rank;
+    t_atom stats[4];
+    
+    if (numRecent == 0) {
+        return;
+    }
+    memcpy(sorted, profiler->recentNs, numRecent * sizeof(float));
+    qsort(sorted, numRecent, sizeof(float), profiler_compare_floats);
+    /* Nearest rank: the smallest time at or above 99% of the others. */
+    rank = (int)ceil(0.99 * numRecent) - 1;
+    
+    SETFLOAT(&stats[0], (t_float)profiler->minNs);
+    SETFLOAT(&stats[1], (t_float)(profiler->totalNs / profiler->numBlocks));
+    SETFLOAT(&stats[2], (t_float)profiler->maxNs);
+    SETFLOAT(&stats[3], (t_float)sorted[rank < 0 ? 0 : rank]);
+    outlet_list(outlet, &s_list, 4, stats);
+}
+
+/* Writes the trace's events as a Chrome trace, one track per object, and returns 0 if the file could not
+ be opened. Times are in microseconds from the start of the trace. */
+static int
+profiler_trace_write (profiler_trace_t* trace) {
+    FILE *file = fopen(trace->path, "w");
+    char *named;
+    long i;
+    
+    if (!file) {
+        return 0;
+    }
+    named = (char *)getbytes(trace->numIds + 1);
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (i = 0; i < trace->numEvents; i++) {
+        const profiler_event_t *event = &trace->events[i];
+        if (!named[event->id]) {
+            fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s %d\"}},\n", event->id, event->name->s_name, event->id);
+            named[event->id] = 1;
+        }
+        fprintf(file, "{\"name\": \"%s\", \"cat\": \"perform\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+                "\"ts\": %.3f, \"dur\": %.3f}%s\n", event->name->s_name, event->id,
+                (event->start - trace->start) * 1e-3, event->duration * 1e-3, (i + 1 < trace->numEvents ? "," : ""));
+    }
+    fprintf(file, "]}\n");
+    freebytes(named, trace->numIds + 1);
+    fclose(file);
+    return 1;
+}
+
+static void
+profiler_trace_stop (profiler_trace_t* trace) {
+    if (!trace->running) {
+        return;
+    }
+    trace->running = 0;
+    if (profiler_trace_write(trace)) {
+        post("%s: %ld blocks written to %s%s", PROFILER_TRACE_NAME, trace->numEvents, trace->path,
+             (trace->numDropped > 0 ? ", the trace was full for the rest" : ""));
+    } else {
+        pd_error(trace, "%s: cannot write %s", PROFILER_TRACE_NAME, trace->path);
+    }
+    freebytes(trace->events, PROFILER_TRACE_EVENTS * sizeof(profiler_event_t));
+    trace->events = NULL;
+}
+
+/* Handles 'trace FILE', which starts tracing every object in the process (after writing out a trace that
+ was running), and 'trace 0' or 'trace', which stops and writes the file. */
+static void
+profiler_trace_switch (profiler_t* profiler, int argc, t_atom* argv) {
+    profiler_trace_t *trace = profiler->trace;
+    
+    profiler_trace_stop(trace);
+    if (argc > 0 && argv[0].a_type == A_SYMBOL) {
+        canvas_makefilename(profiler->canvas, atom_getsymbol(argv)->s_name, trace->path, MAXPDSTRING);
+        trace->events = (profiler_event_t *)getbytes(PROFILER_TRACE_EVENTS * sizeof(profiler_event_t));
+        trace->numEvents = trace->numDropped = 0;
+        trace->start = profiler_now_ns();
+        trace->running = 1;
+    }
+}
+
+#endif /* PD_EXTERNALS_PROFILING */
+
+#endif /* PROFILER_H */
@@ -0,0 +1,148 @@
+//  Copyright (c) 2018 Flyingsand
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+//  Click-free parameter changes. A smoother ramps from the current value of a parameter to
+//  each new target, either linearly or with a one-pole exponential curve, and writes the
+//  ramp into a vector the perform routine reads per sample. Once a ramp has finished the
+//  smoother reports itself settled and the parameter can be used as a constant again.
+//
+
+#ifndef SMOOTHER_H
+#define SMOOTHER_H
+
+#include "m_pd.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+# define SMOOTHER_INLINE __inline
+#else
+# define SMOOTHER_INLINE inline
+#endif
+
+enum {
+    SMOOTHER_LINEAR = 0, /* Reaches the target after the smoothing time. */
+    SMOOTHER_EXPONENTIAL = 1 /* Covers 99% of the change in the smoothing time, settling once the rest is negligible. */
+};
+
+struct _smoother {
+    t_float current;
+    t_float target;
+    int mode;
+    t_float length; /* Smoothing time in samples; below one sample, changes are immediate. */
+    t_float decay; /* Per-sample factor of the remaining distance in exponential mode. */
+    t_float step; /* Per-sample increment of the current linear ramp. */
+    int remaining; /* Samples left in a linear ramp; 0 (or 1 in exponential mode) while unsettled. */
+};
+
+typedef struct _smoother smoother_t;
+
+static SMOOTHER_INLINE void
+smoother_init (smoother_t* smoother, t_float value) {
+    smoother->current = value;
+    smoother->target = value;
+    smoother->mode = SMOOTHER_LINEAR;
+    smoother->length = 0.f;
+    smoother->decay = 0.f;
+    smoother->step = 0.f;
+    smoother->remaining = 0;
+}
+
+/* Jumps to value, ending any ramp. */
+static SMOOTHER_INLINE void
+smoother_reset (smoother_t* smoother, t_float value) {
+    smoother->current = value;
+    smoother->target = value;
+    smoother->remaining = 0;
+}
+
+static SMOOTHER_INLINE void
+smoother_configure (smoother_t* smoother, t_float milliseconds, int mode, t_float sampleRate) {
+    smoother->mode = mode;
+    smoother->length = (milliseconds > 0.f ? milliseconds * sampleRate * 0.001f : 0.f);
+    smoother->decay = (smoother->length >= 1.f ? (t_float)exp(log(0.01) / smoother->length) : 0.f);
+}
+
+/* Parses a mode name, "lin" or "exp". Returns -1 for anything else. */
+static SMOOTHER_INLINE int
+smoother_mode_find (t_symbol* name) {
+    if (strcmp(name->s_name, "lin") == 0) {
+        return SMOOTHER_LINEAR;
+    } else if (strcmp(name->s_name, "exp") == 0) {
+        return SMOOTHER_EXPONENTIAL;
+    }
+    return -1;
+}
+
+static SMOOTHER_INLINE int
+smoother_settled (const smoother_t* smoother) {
+    return (smoother->remaining == 0);
+}
+
+static SMOOTHER_INLINE void
+smoother_set_target (smoother_t* smoother, t_float target) {
+    smoother->target = target;
+    if (smoother->length < 1.f || target == smoother->current) {
+        smoother->current = target;
+        smoother->remaining = 0;
+    } else if (smoother->mode == SMOOTHER_LINEAR) {
+        smoother->remaining = (int)(smoother->length + 0.5f);
+        smoother->step = (target - smoother->current) / (t_float)smoother->remaining;
+    } else {
+        smoother->remaining = 1;
+    }
+}
+
+/* Writes the next numSamples values of the parameter to out. The linear ramp is computed from its start
+ for each sample rather than accumulated, so the loop has no dependency between samples and vectorizes. */
+static SMOOTHER_INLINE void
+smoother_fill (smoother_t* smoother, t_sample* out, int numSamples) {
+    int i = 0;
+
+    if (smoother->remaining > 0 && smoother->mode == SMOOTHER_LINEAR) {
+        const t_float start = smoother->current;
+        const t_float step = smoother->step;
+        int ramp = (numSamples < smoother->remaining ? numSamples : smoother->remaining);
+        for (; i < ramp; i++) {
+            out[i] = start + step * (t_float)(i + 1);
+        }
+        smoother->remaining -= ramp;
+        smoother->current = (smoother->remaining == 0 ? smoother->target : start + step * (t_float)ramp);
+    } else if (smoother->remaining > 0) {
+        const t_float target = smoother->target;
+        const t_float decay = smoother->decay;
+        t_float distance = smoother->current - target;
+        for (; i < numSamples; i++) {
+            distance *= decay;
+            out[i] = target + distance;
+        }
+        smoother->current = target + distance;
+        /* 99% of the way there after the smoothing time; the rest is below what can be heard. */
+        if (fabs(distance) <= 1e-5 * (fabs(target) + 1.)) {
+            smoother->current = target;
+            smoother->remaining = 0;
+        }
+    }
+    for (; i < numSamples; i++) {
+        out[i] = smoother->current;
+    }
+}
+
+#endif /* SMOOTHER_H */